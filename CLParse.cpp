@@ -48,6 +48,14 @@ void parseSettings(char *argv[], int argc, SETTINGS_FILTERS &settings, string &b
 	fasta_file = argv[argc - 2];
 	position_file = argv[argc - 1];
 	
+	//keep the options of the run (but those of capturing) for the bundles of captured loci:
+	for (int i = 1; i < argc-3; ++i) {
+		string sw = argv[i];
+		if (sw == "-capture" || sw == "-capturelist" || sw == "-capturedir") { ++i; continue; }
+		if (settings.options != "") settings.options += " ";
+		settings.options += sw;
+	}
+	
 	for (int i = 1; i < argc-3; ++i) {
 		string sw = argv[i];
 		
@@ -109,9 +117,96 @@ void parseSettings(char *argv[], int argc, SETTINGS_FILTERS &settings, string &b
 			//set haploid/diploid mode
 			settings.mode = 1;
 		}	
+		else if (sw == "-ploidy") {
+			//genotype N copies of each locus (polyploid genomes & pooled samples)
+			++i;
+			settings.mode = atoi(argv[i]);
+			if (settings.mode < 1) throw "Ploidy must be at least 1.";
+		}
 		else if (sw == "-emitconfidentsites") {
 			settings.emitAll = 1;
+		}
+		else if (sw == "-gvcf") {
+			settings.gvcf = true;
 		}		
+		else if (sw == "-progress") {
+			//seconds between progress reports on stderr
+			++i;
+			settings.progress = atof(argv[i]);
+		}
+		else if (sw == "-metrics") {
+			//Prometheus textfile to keep up to date with the progress
+			++i;
+			settings.metricsFile = argv[i];
+		}
+		else if (sw == "-threadstats") {
+			//print the time each worker thread spent busy, reading & waiting
+			settings.threadStats = true;
+		}
+		else if (sw == "-trace") {
+			//Chrome trace file of the stages of each thread
+			++i;
+			settings.traceFile = argv[i];
+		}
+		else if (sw == "-tracesample") {
+			//trace every Nth locus
+			++i;
+			settings.traceSample = atoi(argv[i]);
+		}
+		else if (sw == "-tracewindow") {
+			//trace only from..to seconds into the run
+			++i;
+			string window = argv[i];
+			size_t colon = window.find(":");
+			settings.traceFrom = atof(window.substr(0, colon).c_str());
+			if (colon != string::npos) settings.traceTo = atof(window.substr(colon+1).c_str());
+		}
+		else if (sw == "-perf") {
+			//hardware counters per stage
+			settings.perfCounters = true;
+		}
+		else if (sw == "-dryrun") {
+			//estimate the resources of the run without genotyping
+			settings.dryRun = true;
+		}
+		else if (sw == "-readcost") {
+			//microseconds per read for -dryrun
+			++i;
+			settings.readCost = atof(argv[i]);
+		}
+		else if (sw == "-capture") {
+			//seconds after which a locus is captured to a bundle
+			++i;
+			settings.captureSeconds = atof(argv[i]);
+		}
+		else if (sw == "-capturelist") {
+			//file of regions to capture, one a line
+			++i;
+			ifstream list(argv[i]);
+			if (!list.is_open()) throw "Unable to open capture list.";
+			string line;
+			while (getline(list, line)) settings.captureRegions.insert(line.substr(0, line.find_first_of(" \t")));
+		}
+		else if (sw == "-capturedir") {
+			//directory to write the bundles to
+			++i;
+			settings.captureDir = argv[i];
+		}
+		else if (sw == "-budget") {
+			//per-locus time budget (seconds)
+			++i;
+			settings.budget = atof(argv[i]);
+		}
+		else if (sw == "-k") {
+			//length of the flank anchors (repeatseq fastq)
+			++i;
+			settings.anchorK = atoi(argv[i]);
+		}
+		else if (sw == "-deep") {
+			//estimated number of reads above which a locus' reads are shared among idle threads
+			++i;
+			settings.deepReads = atoi(argv[i]);
+		}
 
 		//FILTERS:
 		else if (sw == "-pp") {
@@ -133,6 +228,21 @@ void parseSettings(char *argv[], int argc, SETTINGS_FILTERS &settings, string &b
 			settings.paramString += ".R";
 			settings.paramString += argv[i];
 		}
+		else if (sw == "-flankerrors") {
+			//keep reads failing -L/-R if their flank is within this edit distance of the reference's
+			++i;
+			settings.flankErrors = atoi(argv[i]);
+			settings.paramString += ".flankerrors";
+			settings.paramString += argv[i];
+		}
+		else if (sw == "-flankwindow") {
+			//flank bases next to the repeat compared with -flankerrors
+			++i;
+			settings.flankWindow = atoi(argv[i]);
+			if (settings.flankWindow < 1 || settings.flankWindow > FLANK_WORD) throw "-flankwindow must be from 1 to 64.";
+			settings.paramString += ".flankwindow";
+			settings.paramString += argv[i];
+		}
 		else if (sw == "-M") {
 			//MINIMUM MapQuality Score
 			++i;
@@ -140,6 +250,31 @@ void parseSettings(char *argv[], int argc, SETTINGS_FILTERS &settings, string &b
 			settings.paramString += ".M";
 			settings.paramString += argv[i];
 		}
+		else if (sw == "-families") {
+			//collapse PCR-duplicate families (same start, strand & mate start) to one read each
+			settings.families = true;
+			settings.paramString += ".families";
+		}
+		else if (sw == "-umi") {
+			//collapse families by the UMI in this tag
+			++i;
+			settings.families = true;
+			settings.umiTag = argv[i];
+			settings.paramString += ".umi";
+			settings.paramString += argv[i];
+		}
+		else if (sw == "-realign") {
+			//realign reads against the reference repeat with up to N units added or removed
+			++i;
+			settings.realignUnits = atoi(argv[i]);
+			settings.paramString += ".realign";
+			settings.paramString += argv[i];
+		}
+		else if (sw == "-longreads") {
+			//index the CIGAR of each read & read loci up to LONG_READ_SIZE bases apart as one run
+			settings.longReads = true;
+			settings.MAX_READ_SIZE = LONG_READ_SIZE;
+		}
 		else if (sw == "-multi") {
 			//MULTI Filter (exclude read if XT:A:R tag is present)
 			settings.paramString += ".multi";
@@ -151,6 +286,18 @@ void parseSettings(char *argv[], int argc, SETTINGS_FILTERS &settings, string &b
 		else if (sw == "-calls") {
 			settings.makeCallsFile = true;
 		}
+		else if (sw == "-columns") {
+			settings.columns = true;
+		}
+		else if (sw == "-pileup") {
+			settings.pileup = true;
+		}
+		else if (sw == "-summary") {
+			settings.summary = true;
+		}
+		else if (sw == "-qc") {
+			settings.qc = true;
+		}
 		else throw "IMPROPER COMMAND LINE ARGUMENT. Exiting..";
 	}
 }
@@ -162,20 +309,53 @@ void printArguments(){
 
 	cout << endl << "-----------------------------------------------------------\n\n";
 	cout << "RepeatSeq v" << VERSION << "\n\n";
-	cout << "Usage:\t repeatseq [options] <in.bam> <in.fasta> <in.regions>\n\n";
+	cout << "Usage:\t repeatseq [options] <in.bam> <in.fasta> <in.regions>\n";
+	cout << "\t repeatseq replay <bundle directory> [options]\n";
+	cout << "\t repeatseq columns <in.columns> [-rows FROM:TO] [column ...]\n";
+	cout << "\t repeatseq pileup <in.pileup>\n";
+	cout << "\t repeatseq view <in.repeatseq|in.calls> <chr:start-end | chr | region file line> ...\n";
+	cout << "\t repeatseq fastq [options] <in.fastq[.gz]> <in.fasta> <in.regions>\n";
+	cout << "\t repeatseq discover <in.fasta> [-maxunit N] [-minscore N] [-minpurity F] [-threads N] > out.regions\n\n";
 	cout << "Options:";
 	cout << " -r\t\tuse only a specific read length or range of read lengths (e.g. LENGTH or MIN:MAX)";
 	cout << "\n\t -L\t\trequired number of reference matching bases BEFORE the repeat [3]";
 	cout << "\n\t -R\t\trequired number of reference matching bases AFTER the repeat [3]";
+	cout << "\n\t -flankerrors\tkeep reads failing -L/-R whose flank is within N edits of the reference flank [0 = off]";
+	cout << "\n\t -flankwindow\tflank bases next to the repeat compared with -flankerrors (at most 64) [32]";
 	cout << "\n\t -M\t\tminimum mapping quality for a read to be used for allele determination";
+	cout << "\n\t -realign\trealign reads against the repeat with up to N units added or removed, taking the best allele [0 = off]";
+	cout << "\n\t -longreads\tlong-read mode (10-100kb reads): walk only the part of each read around each locus it spans";
 	cout << "\n\t -multi\t\texclude reads flagged with the XT:A:R tag";
 	cout << "\n\t -pp\t\texclude reads that are not properly paired (for PE reads only)";
+	cout << "\n\t -families\tcollapse duplicate reads (same start, strand & mate start) to one consensus read per family";
+	cout << "\n\t -umi\t\tcollapse reads to one per family by the UMI in this tag (e.g. RX) & fragment start";
 	cout << "\n\t -emitconfidentsites\t\treport all confident genotypes even if they do not vary from ref";
+	cout << "\n\t -gvcf\t\twrite a gVCF (.g.vcf): runs of loci called reference, or not called, become single block records";
 	cout << "\n";
 	cout << "\n\t -haploid\tassume a haploid rather than diploid genome";
+	cout << "\n\t -ploidy\tgenotype N copies of each locus, for polyploid genomes & pooled samples [2]";
+	cout << "\n\t -progress\tprint progress, rates & ETA to stderr every N seconds (0 = never) [0]";
+	cout << "\n\t -metrics\tkeep a Prometheus textfile of the progress up to date at this path";
+	cout << "\n\t -threadstats\tprint the utilization of each worker thread to stderr at the end of the run";
+	cout << "\n\t -trace\twrite a Chrome trace (Perfetto, chrome://tracing) of each thread's stages to this file";
+	cout << "\n\t -tracesample\ttrace every Nth locus [1]";
+	cout << "\n\t -tracewindow\ttrace only from FROM to TO seconds into the run (FROM:TO)";
+	cout << "\n\t -perf\t\tprint cycles, instructions, LLC & branch misses per stage to stderr (Linux perf events)";
+	cout << "\n\t -dryrun\testimate reads, wall time per thread count & peak memory from the BAM index, without genotyping";
+	cout << "\n\t -readcost\tmicroseconds per read for -dryrun (printed by -threadstats) [20]";
+	cout << "\n\t -capture\tcapture loci taking longer than this (seconds) to bundles for \"repeatseq replay\" (0 = never) [0]";
+	cout << "\n\t -capturelist\tcapture the regions listed in this file";
+	cout << "\n\t -capturedir\tdirectory to write captured bundles to [capture]";
+	cout << "\n\t -budget\tseconds a locus may take before it is downsampled & flagged TIMEOUT (0 = no limit) [0]";
+	cout << "\n\t -k\t\tbases of each flank anchoring a locus in the reads of \"repeatseq fastq\" (at most 32) [12]";
+	cout << "\n\t -deep\t\testimated reads at which a locus is split among idle threads (0 = never) [10000]";
 	cout << "\n";	
 	cout << "\n\t -repeatseq\twrite .repeatseq file containing additional information about reads";
 	cout << "\n\t -calls\t\twrite .calls file";
+	cout << "\n\t -pileup\twrite .pileup file, the reads of the .repeatseq file in a compact binary format";
+	cout << "\n\t -columns\twrite .columns file of per-locus results in a binary, column-by-column format";
+	cout << "\n\t -summary\twrite .summary file of call rates & mean concordance by unit size & reference length";
+	cout << "\n\t -qc\t\twrite only .qc file of the depth, spanning reads & MapQ of each locus, without genotyping";
 	cout << "\n\t -t\t\tinclude user-defined tag in the output filename";
 	cout << "\n\t -o\t\tnumber of flanking bases to output from each read";
 	cout << "\n";
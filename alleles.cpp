@@ -0,0 +1,131 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Alleles module: the sequences of the alleles of a locus, counted as its reads are collected
+//
+// addRead() adds the allele of each read it keeps (as alleleSequence() gives it) to the
+// ALLELE_TABLE of its locus: an open-addressing hash table keyed on the allele packed 2 bits a
+// base (sequences holding other letters are kept as text).  getVCF() needs, for each allele
+// length, the sequence most reads have (the lexicographically first on a tie); representatives()
+// gives them from the table without going back over the reads.
+
+#include "repeatseq.h"
+#include <algorithm>
+
+#define ALLELE_TABLE_SIZE 16        // initial slots (a power of 2), doubled at half full
+
+//2-bit code of a base, or -1
+inline int baseCode(char c){
+	switch (c) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+	}
+	return -1;
+}
+
+inline uint64_t mixHash(uint64_t h){
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+ALLELE_TABLE::ALLELE_TABLE(){
+	used = 0;
+}
+
+//pack an allele into words (32 bases a word); false if it holds a letter other than ACGT
+bool ALLELE_TABLE::pack(const string &allele, vector<uint64_t> &packed){
+	packed.assign((allele.length() + 31) / 32, 0);
+	for (size_t i = 0; i < allele.length(); ++i) {
+		int code = baseCode(allele[i]);
+		if (code < 0) return false;
+		packed[i / 32] |= uint64_t(code) << (2 * (i % 32));
+	}
+	return true;
+}
+
+//the slot holding an allele, or the empty slot where it belongs
+size_t ALLELE_TABLE::find(const vector<uint64_t> &packed, const string &text, uint32_t length, uint64_t hash) const {
+	size_t mask = slots.size() - 1;
+	for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+		const ENTRY &entry = slots[slot];
+		if (!entry.count) return slot;
+		if (entry.hash != hash || entry.length != length || entry.text != text) continue;
+		if (text.empty() && !equal(packed.begin(), packed.end(), words.begin() + entry.word)) continue;
+		return slot;
+	}
+}
+
+void ALLELE_TABLE::insert(const vector<uint64_t> &packed, const string &text, uint32_t length, uint64_t hash, uint32_t count){
+	if (2 * (used + 1) > slots.size()) {
+		vector<ENTRY> old;
+		old.swap(slots);
+		slots.resize(old.empty() ? ALLELE_TABLE_SIZE : 2 * old.size());
+		size_t mask = slots.size() - 1;
+		for (vector<ENTRY>::iterator it = old.begin(); it < old.end(); ++it) {
+			if (!it->count) continue;
+			size_t slot = it->hash & mask;
+			while (slots[slot].count) slot = (slot + 1) & mask;
+			slots[slot] = *it;
+		}
+	}
+	size_t slot = find(packed, text, length, hash);
+	ENTRY &entry = slots[slot];
+	if (!entry.count) {
+		entry.hash = hash;
+		entry.length = length;
+		entry.text = text;
+		entry.word = words.size();
+		words.insert(words.end(), packed.begin(), packed.end());
+		++used;
+	}
+	entry.count += count;
+}
+
+void ALLELE_TABLE::add(const string &allele, uint32_t count){
+	vector<uint64_t> packed;
+	string text;
+	uint64_t hash = mixHash(allele.length() + 1);
+	if (pack(allele, packed)) {
+		for (vector<uint64_t>::iterator it = packed.begin(); it < packed.end(); ++it) hash = mixHash(hash ^ *it);
+	}
+	else {
+		packed.clear();
+		text = allele;
+		for (string::iterator c = text.begin(); c < text.end(); ++c) hash = mixHash(hash ^ uint64_t((unsigned char) *c));
+	}
+	insert(packed, text, allele.length(), hash, count);
+}
+
+//the sequence of an entry
+string ALLELE_TABLE::sequence(const ENTRY &entry) const {
+	if (!entry.text.empty() || !entry.length) return entry.text;
+	string allele(entry.length, 'A');
+	for (uint32_t i = 0; i < entry.length; ++i) allele[i] = "ACGT"[(words[entry.word + i / 32] >> (2 * (i % 32))) & 3];
+	return allele;
+}
+
+void ALLELE_TABLE::merge(const ALLELE_TABLE &other){
+	for (vector<ENTRY>::const_iterator it = other.slots.begin(); it < other.slots.end(); ++it)
+		if (it->count) add(other.sequence(*it), it->count);
+}
+
+//the most common sequence of each length (the lexicographically first on a tie), shortest first
+vector<string> ALLELE_TABLE::representatives() const {
+	map<uint32_t, pair<uint32_t,string> > best;     //length -> count & sequence
+	for (vector<ENTRY>::const_iterator it = slots.begin(); it < slots.end(); ++it) {
+		if (!it->count) continue;
+		string allele = sequence(*it);
+		map<uint32_t, pair<uint32_t,string> >::iterator jt = best.find(it->length);
+		if (jt == best.end()) best.insert(make_pair(it->length, make_pair(it->count, allele)));
+		else if (it->count > jt->second.first || (it->count == jt->second.first && allele < jt->second.second)) jt->second = make_pair(it->count, allele);
+	}
+	vector<string> alleles;
+	alleles.reserve(best.size());
+	for (map<uint32_t, pair<uint32_t,string> >::iterator it = best.begin(); it != best.end(); ++it) alleles.push_back(it->second.second);
+	return alleles;
+}
@@ -0,0 +1,158 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Allocation profiler: counts of operator new & delete per stage, built with "make ALLOC_PROFILE=1"
+//
+// Replacement operator new & delete keep a small header in front of each block holding its size &
+// the stage that allocated it (the innermost perfBegin() of the allocating thread, or "other"),
+// so the bytes still live & the peak of each stage can be followed as blocks are freed anywhere.
+// Each thread also keeps running totals of its own, which print_output() uses to charge each locus
+// with what its addRead() & print_output() calls allocated; the slowest loci are listed with
+// those counts at the end of the run.
+
+#ifdef ALLOC_PROFILE
+
+#include "repeatseq.h"
+#include <new>
+
+//loci listed at the end of the run:
+#define SLOWEST_LOCI 10
+
+//bytes in front of each block (keeping the block 16-byte aligned):
+#define ALLOC_HEADER 16
+
+#if __cplusplus >= 201103L
+#define ALLOC_THROW
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROW throw(std::bad_alloc)
+#define ALLOC_NOTHROW throw()
+#endif
+
+extern const char * perfStageNames[];
+
+struct ALLOC_HEADER_T {
+	size_t size;
+	int stage;
+};
+
+//counts of each stage (updated with __sync builtins); [PERF_STAGES] is "other":
+uint64_t allocCount[PERF_STAGES + 1], allocBytes[PERF_STAGES + 1];
+int64_t allocLive[PERF_STAGES + 1], allocPeak[PERF_STAGES + 1];
+int64_t allocLiveTotal = 0, allocPeakTotal = 0;
+
+__thread int allocStage = PERF_STAGES;      // stage of the calling thread
+__thread uint64_t threadCount = 0, threadBytes = 0;
+
+struct SLOW_LOCUS {
+	string region;
+	double seconds;
+	uint64_t allocations, bytes;
+};
+vector<SLOW_LOCUS> slowestLoci;             // the slowest loci so far, slowest first
+double slowestThreshold = 0;                // loci faster than this don't make the list
+pthread_mutex_t allocMutex = PTHREAD_MUTEX_INITIALIZER;
+
+inline void raisePeak(int64_t &peak, int64_t live){
+	int64_t old = peak;
+	while (live > old && !__sync_bool_compare_and_swap(&peak, old, live)) old = peak;
+}
+
+inline void * countedAlloc(size_t size){
+	char * block = (char *) malloc(size + ALLOC_HEADER);
+	if (!block) return NULL;
+	ALLOC_HEADER_T &header = *((ALLOC_HEADER_T *) block);
+	header.size = size;
+	header.stage = allocStage;
+
+	__sync_fetch_and_add(&allocCount[header.stage], 1);
+	__sync_fetch_and_add(&allocBytes[header.stage], size);
+	raisePeak(allocPeak[header.stage], __sync_add_and_fetch(&allocLive[header.stage], size));
+	raisePeak(allocPeakTotal, __sync_add_and_fetch(&allocLiveTotal, size));
+	++threadCount;
+	threadBytes += size;
+	return block + ALLOC_HEADER;
+}
+
+inline void countedFree(void * p){
+	if (!p) return;
+	char * block = (char *) p - ALLOC_HEADER;
+	ALLOC_HEADER_T &header = *((ALLOC_HEADER_T *) block);
+	__sync_fetch_and_sub(&allocLive[header.stage], header.size);
+	__sync_fetch_and_sub(&allocLiveTotal, header.size);
+	free(block);
+}
+
+void * operator new(size_t size) ALLOC_THROW {
+	void * p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void * operator new[](size_t size) ALLOC_THROW {
+	void * p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void * operator new(size_t size, const std::nothrow_t &) ALLOC_NOTHROW { return countedAlloc(size); }
+void * operator new[](size_t size, const std::nothrow_t &) ALLOC_NOTHROW { return countedAlloc(size); }
+void operator delete(void * p) ALLOC_NOTHROW { countedFree(p); }
+void operator delete[](void * p) ALLOC_NOTHROW { countedFree(p); }
+void operator delete(void * p, const std::nothrow_t &) ALLOC_NOTHROW { countedFree(p); }
+void operator delete[](void * p, const std::nothrow_t &) ALLOC_NOTHROW { countedFree(p); }
+
+//make stage the stage of the calling thread, returning the one it replaces
+int allocEnter(int stage){
+	int outer = allocStage;
+	allocStage = stage;
+	return outer;
+}
+
+void allocLeave(int outer){
+	allocStage = outer;
+}
+
+//allocations & bytes allocated by the calling thread so far
+void allocSnapshot(uint64_t &allocations, uint64_t &bytes){
+	allocations = threadCount;
+	bytes = threadBytes;
+}
+
+//consider a locus for the list of the slowest
+void allocLocus(const string &region, double seconds, uint64_t allocations, uint64_t bytes){
+	if (seconds <= slowestThreshold) return;
+	pthread_mutex_lock(&allocMutex);
+	SLOW_LOCUS locus;
+	locus.region = region;
+	locus.seconds = seconds;
+	locus.allocations = allocations;
+	locus.bytes = bytes;
+	vector<SLOW_LOCUS>::iterator it = slowestLoci.begin();
+	while (it < slowestLoci.end() && it->seconds >= seconds) ++it;
+	slowestLoci.insert(it, locus);
+	if (slowestLoci.size() > SLOWEST_LOCI) slowestLoci.pop_back();
+	if (slowestLoci.size() == SLOWEST_LOCI) slowestThreshold = slowestLoci.back().seconds;
+	pthread_mutex_unlock(&allocMutex);
+}
+
+void printAllocStats(){
+	stringstream table;
+	table << setiosflags(ios::fixed) << setprecision(1);
+	table << "stage\tallocations\tbytes\tbytes/allocation\tpeak live bytes\n";
+	for (int s = 0; s <= PERF_STAGES; ++s) {
+		if (!allocCount[s]) continue;
+		table << perfStageNames[s] << '\t' << allocCount[s] << '\t' << allocBytes[s] << '\t';
+		table << double(allocBytes[s]) / allocCount[s] << '\t' << allocPeak[s] << '\n';
+	}
+	table << "peak live bytes (all stages): " << allocPeakTotal << '\n';
+
+	table << setprecision(4);
+	table << "slowest loci\tseconds\tallocations\tbytes\n";
+	for (vector<SLOW_LOCUS>::iterator it = slowestLoci.begin(); it < slowestLoci.end(); ++it)
+		table << it->region << '\t' << it->seconds << '\t' << it->allocations << '\t' << it->bytes << '\n';
+	cerr << table.str() << flush;
+}
+
+#endif
@@ -0,0 +1,87 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// BAM index (.bai) module: estimates how many reads a region holds from the index alone
+//
+// The linear index of a .bai file gives, for each 16kb window of a reference, the file offset of
+// the first read overlapping that window; the pseudo-bin (37450) of each reference holds its
+// number of mapped reads and the offsets of its first & last read. Dividing the compressed bytes
+// spanned by the windows of a region by the compressed bytes per read of its reference gives the
+// reads of those windows without touching the BAM file; scaled from the windows' length to the
+// region's plus a read length (the reads overlapping a region start up to a read before it), it
+// estimates the reads overlapping the region.
+
+#include "repeatseq.h"
+
+#define BAI_PSEUDO_BIN 37450
+#define BAI_LINEAR_SHIFT 14
+
+template <typename T>
+inline bool readValue(ifstream &in, T &value){
+	in.read((char*) &value, sizeof(T));
+	return in.good();
+}
+
+bool BaiIndex::load(string filename){
+	references.clear();
+
+	ifstream in(filename.c_str(), ios::in | ios::binary);
+	char magic[4];
+	if (!in.read(magic, 4) || magic[0] != 'B' || magic[1] != 'A' || magic[2] != 'I' || magic[3] != 1) return false;
+
+	int32_t numRefs;
+	if (!readValue(in, numRefs) || numRefs < 0) return false;
+	references.resize(numRefs);
+
+	for (int32_t r = 0; r < numRefs; ++r) {
+		REFERENCE &ref = references[r];
+		ref.begin = ref.end = ref.mapped = ref.unmapped = 0;
+
+		int32_t numBins;
+		if (!readValue(in, numBins)) return false;
+		for (int32_t b = 0; b < numBins; ++b) {
+			uint32_t bin;
+			int32_t numChunks;
+			if (!readValue(in, bin) || !readValue(in, numChunks)) return false;
+
+			if (bin == BAI_PSEUDO_BIN && numChunks == 2) {
+				readValue(in, ref.begin);
+				readValue(in, ref.end);
+				readValue(in, ref.mapped);
+				if (!readValue(in, ref.unmapped)) return false;
+			}
+			else in.seekg(numChunks * 2 * sizeof(uint64_t), ios::cur);
+		}
+
+		int32_t numIntervals;
+		if (!readValue(in, numIntervals) || numIntervals < 0) return false;
+		ref.linear.resize(numIntervals);
+		if (numIntervals && !in.read((char*) &ref.linear[0], numIntervals * sizeof(uint64_t))) return false;
+	}
+
+	return true;
+}
+
+//estimate the number of reads of up to readLength bases overlapping [start,stop] (0-based) of reference refID
+double BaiIndex::estimateReads(int refID, int start, int stop, int readLength) const {
+	if (refID < 0 || refID >= int(references.size())) return 0;
+	const REFERENCE &ref = references[refID];
+
+	//compressed offsets (the upper 48 bits of a virtual offset) of the reference's reads:
+	uint64_t refBegin = ref.begin >> 16, refEnd = ref.end >> 16;
+	if (!ref.mapped || refEnd <= refBegin) return 0;
+
+	size_t first = max(start, 0) >> BAI_LINEAR_SHIFT;
+	size_t last = (max(stop, 0) >> BAI_LINEAR_SHIFT) + 1;
+	if (first >= ref.linear.size()) return 0;
+
+	uint64_t from = max(ref.linear[first] >> 16, refBegin);     //windows before the first read may be 0
+	uint64_t to = refEnd;
+	if (last < ref.linear.size() && (ref.linear[last] >> 16) >= from) to = ref.linear[last] >> 16;
+	if (to <= from) return 0;
+
+	double windowReads = double(to - from) * double(ref.mapped) / double(refEnd - refBegin);
+	double span = double(last - first) * (1 << BAI_LINEAR_SHIFT);
+	return windowReads * min(1.0, (max(stop, start) - start + 1 + readLength) / span);
+}
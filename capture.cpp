@@ -0,0 +1,170 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Capture module: self-contained bundles of slow loci, & the replay subcommand that re-runs them
+//
+// Loci that take longer than -capture seconds (from their first read until they are printed) or
+// that are named in a -capturelist file are noted by the worker threads; once a worker has
+// finished its share, it writes a bundle for each into a directory of the -capturedir:
+//   reads.bam (+ .bai)   the alignments overlapping the locus, moved onto the reference window
+//   reference.fa         the window of the reference around the locus & its reads
+//   regions.txt          the line of the region file, moved onto the window
+//   info.txt             the original region line, the offset of the window, the time the locus
+//                        took & the options of the run
+// "repeatseq replay <bundle> [options]" runs the locus of a bundle again with the options of the
+// original run (& any others given), with the hardware counters & thread statistics switched on.
+
+#include "repeatseq.h"
+#include "api/BamWriter.h"
+#include <sys/stat.h>
+#include <errno.h>
+
+//note a finished locus for capture if it was slow or asked for
+void captureLocus(worker_data_t &worker, const LOCUS &locus, double started){
+	const SETTINGS_FILTERS &settings = worker.settings;
+	double seconds = started ? wallTime() - started : 0;
+	bool slow = settings.captureSeconds && seconds > settings.captureSeconds;
+	if (slow || settings.captureRegions.count(locus.region)) worker.captures.push_back(make_pair(locus, seconds));
+}
+
+//make a directory (which may already exist)
+bool makeDirectory(const string &path){
+	return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+//the SAM header text of the reader with its @SQ lines replaced by one for the window
+string windowHeader(const string &text, const string &chr, int length){
+	stringstream in(text), out;
+	string line;
+	bool added = false;
+	while (getline(in, line)) {
+		if (line.compare(0, 3, "@SQ") == 0) continue;
+		if (!added && line.compare(0, 3, "@HD") != 0) {
+			out << "@SQ\tSN:" << chr << "\tLN:" << length << '\n';
+			added = true;
+		}
+		out << line << '\n';
+	}
+	if (!added) out << "@SQ\tSN:" << chr << "\tLN:" << length << '\n';
+	return out.str();
+}
+
+//write the bundle of a locus; the reader of the worker must be done with its regions
+bool writeBundle(worker_data_t &worker, const LOCUS &locus, double seconds){
+	const SETTINGS_FILTERS &settings = worker.settings;
+	BamReader &reader = worker.reader;
+	const string &chr = locus.target.startSeq;
+	int refID = reader.GetReferenceID(chr);
+	if (refID < 0) return false;
+	int refLength = reader.GetReferenceData()[refID].RefLength;
+
+	//the reads overlapping the locus, & a window of the reference holding them & the locus' flanks
+	vector<BamAlignment> reads;
+	int windowStart = locus.left - settings.MAX_READ_SIZE, windowEnd = locus.right + settings.MAX_READ_SIZE;
+	BamAlignment al;
+	reader.SetRegion(BamRegion(refID, locus.left, refID, locus.right));
+	while (reader.GetNextAlignment(al)) {
+		if (!overlapsLocus(al, locus)) continue;
+		windowStart = min(windowStart, al.Position);
+		windowEnd = max(windowEnd, al.GetEndPosition());
+		reads.push_back(al);
+	}
+	windowStart = max(windowStart, 0);
+	windowEnd = min(windowEnd, refLength);
+	int windowLength = windowEnd - windowStart;
+
+	stringstream name;
+	name << settings.captureDir << '/' << chr << '_' << locus.target.startPos << '-' << locus.target.stopPos;
+	string bundle = name.str();
+	if (!makeDirectory(settings.captureDir) || !makeDirectory(bundle)) return false;
+
+	//reads, moved onto the window:
+	RefVector references(1);
+	references[0].RefName = chr;
+	references[0].RefLength = windowLength;
+	BamWriter writer;
+	if (!writer.Open(bundle + "/reads.bam", windowHeader(reader.GetHeaderText(), chr, windowLength), references)) return false;
+	for (vector<BamAlignment>::iterator it = reads.begin(); it < reads.end(); ++it) {
+		it->RefID = 0;
+		it->Position -= windowStart;
+		if (it->MateRefID == refID && it->MatePosition >= windowStart && it->MatePosition < windowEnd) {
+			it->MateRefID = 0;
+			it->MatePosition -= windowStart;
+		}
+		else {
+			it->MateRefID = -1;
+			it->MatePosition = -1;
+		}
+		writer.SaveAlignment(*it);
+	}
+	writer.Close();
+	BamReader indexer;
+	if (!indexer.Open(bundle + "/reads.bam") || !indexer.CreateIndex()) return false;
+	indexer.Close();
+
+	//reference window, 60 bases a line:
+	ofstream fasta((bundle + "/reference.fa").c_str());
+	string sequence = worker.fr->getSubSequence(chr, windowStart, windowLength);
+	fasta << '>' << chr << '\n';
+	for (size_t i = 0; i < sequence.length(); i += 60) fasta << sequence.substr(i, 60) << '\n';
+	fasta.close();
+
+	//region line, moved onto the window:
+	ofstream regions((bundle + "/regions.txt").c_str());
+	regions << chr << ':' << locus.target.startPos - windowStart << '-' << locus.target.stopPos - windowStart << '\t' << locus.secondColumn << '\n';
+	regions.close();
+
+	ofstream info((bundle + "/info.txt").c_str());
+	info << "region\t" << locus.region << '\t' << locus.secondColumn << '\n';
+	info << "offset\t" << windowStart << '\n';
+	info << "reads\t" << reads.size() << '\n';
+	info << "seconds\t" << seconds << '\n';
+	info << "options\t" << settings.options << '\n';
+	info.close();
+
+	return !fasta.fail() && !regions.fail() && !info.fail();
+}
+
+//write the bundles of the loci a worker has noted
+void writeCaptures(worker_data_t &worker){
+	for (vector<pair<LOCUS,double> >::iterator it = worker.captures.begin(); it < worker.captures.end(); ++it)
+		if (!writeBundle(worker, it->first, it->second))
+			cerr << "Could not capture " << it->first.region << " to " << worker.settings.captureDir << endl;
+	worker.captures.clear();
+}
+
+//repeatseq replay <bundle> [options]: run the locus of a bundle again
+int replayBundle(int argc, char* argv[]){
+	if (argc < 3) {
+		cout << "Usage: repeatseq replay <bundle directory> [options]" << endl;
+		return 0;
+	}
+	string bundle = argv[2];
+	ifstream info((bundle + "/info.txt").c_str());
+	if (!info.is_open()) {
+		cout << "Unable to open " << bundle << "/info.txt" << endl;
+		return 0;
+	}
+
+	//the options of the original run, then those given here:
+	vector<string> args(1, argv[0]);
+	string line;
+	while (getline(info, line)) {
+		if (line.compare(0, 8, "options\t") != 0) continue;
+		stringstream options(line.substr(8));
+		string option;
+		while (options >> option) args.push_back(option);
+	}
+	for (int i = 3; i < argc; ++i) args.push_back(argv[i]);
+	args.push_back("-perf");
+	args.push_back("-threadstats");
+	args.push_back(bundle + "/reads.bam");
+	args.push_back(bundle + "/reference.fa");
+	args.push_back(bundle + "/regions.txt");
+
+	vector<char*> replayArgv;
+	for (vector<string>::iterator it = args.begin(); it < args.end(); ++it) replayArgv.push_back(&(*it)[0]);
+	replayArgv.push_back(NULL);
+	return runRepeatseq(int(args.size()), &replayArgv[0]);
+}
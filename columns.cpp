@@ -0,0 +1,415 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Columns module: a binary store of the per-locus results, column by column
+//
+// print_output() appends the results of each locus to the RESULT_COLUMNS of its worker; at the
+// end of the run main() writes them, in the order of the region file, to the -columns file.  Rows
+// are cut into groups of COLUMN_GROUP_ROWS & each column of a group is encoded on its own:
+//   'd' line numbers, delta from the previous row of the group, as zigzag varints
+//   'i' integers as zigzag varints (NA = -1)
+//   'f' 32-bit IEEE floats, little-endian (NA = NaN), stored as 4 planes: the first byte of
+//       every row, then the second... (the exponent bytes of similar values then repeat)
+//   'b' bytes
+//   's' strings, front-coded against the previous row: varint shared prefix, varint length, bytes
+// & the encoded chunk is deflated (zlib).  The genotype column holds every called allele length
+// (polyploid genotypes included), allele1 & allele2 the shortest & longest of them.  The allele
+// histogram of a locus is histogram_size entries of histogram_length & histogram_reads, which hold
+// one row per entry (in the same row groups as their loci).
+//
+// File layout (integers little-endian):
+//   "RSQC" uint32 version
+//   column chunks, group after group
+//   footer: uint32 columns, for each: uint8 length & name, uint8 type;
+//           uint32 groups, for each: uint64 first row, uint32 rows, uint32 histogram entries,
+//           & for each column uint64 offset, uint64 bytes (deflated), uint64 bytes (encoded)
+//   uint64 offset of the footer, "RSQC"
+// so a reader can load one column, or the groups holding a range of rows, without decoding the rest.
+// "repeatseq columns <file> [-rows FROM:TO] [column ...]" prints them as tab-separated text.
+
+#include "repeatseq.h"
+#include <algorithm>
+#include <string.h>
+#include <zlib.h>
+
+#define COLUMN_MAGIC "RSQC"
+#define COLUMN_VERSION 2
+#define COLUMN_GROUP_ROWS 65536
+#define COLUMN_COMPRESSION 6        // zlib level: the file is written once, at the end of the run
+
+enum { COL_LINE, COL_REGION, COL_GENOTYPE, COL_ALLELE1, COL_ALLELE2, COL_CONFIDENCE, COL_DEPTH, COL_READS, COL_STARRED, COL_MAPQ, COL_CONCORDANCE, COL_TIMEOUT, COL_HISTOGRAM_SIZE, COL_HISTOGRAM_LENGTH, COL_HISTOGRAM_READS, NUM_COLUMNS };
+const char *COLUMN_NAMES[NUM_COLUMNS] = { "line", "region", "genotype", "allele1", "allele2", "confidence", "depth", "reads", "starred", "mapq", "concordance", "timeout", "histogram_size", "histogram_length", "histogram_reads" };
+const char COLUMN_TYPES[NUM_COLUMNS] = { 'd', 's', 's', 'i', 'i', 'f', 'i', 'i', 'i', 'f', 'f', 'b', 'i', 'i', 'i' };
+
+void RESULT_COLUMNS::add(const LOCUS &locus, const vector<int> &genotype, double confidence, int depth, int reads, int starred, double mapQ, double concordance, bool timedOut, const vector<GT> &alleles){
+	line.push_back(locus.line);
+	region.push_back(locus.region);
+	this->genotype.push_back(formatGenotype(genotype));
+	allele1.push_back(genotype.empty() ? -1 : *min_element(genotype.begin(), genotype.end()));
+	allele2.push_back(genotype.empty() ? -1 : *max_element(genotype.begin(), genotype.end()));
+	this->confidence.push_back(confidence);
+	this->depth.push_back(depth);
+	this->reads.push_back(reads);
+	this->starred.push_back(starred);
+	this->mapQ.push_back(mapQ);
+	this->concordance.push_back(concordance);
+	timeout.push_back(timedOut);
+	histogramSize.push_back(alleles.size());
+	for (vector<GT>::const_iterator it = alleles.begin(); it < alleles.end(); ++it) {
+		histogramLength.push_back(it->readlength);
+		histogramReads.push_back(it->occurrences);
+	}
+}
+
+void RESULT_COLUMNS::append(const RESULT_COLUMNS &other){
+	line.insert(line.end(), other.line.begin(), other.line.end());
+	region.insert(region.end(), other.region.begin(), other.region.end());
+	genotype.insert(genotype.end(), other.genotype.begin(), other.genotype.end());
+	allele1.insert(allele1.end(), other.allele1.begin(), other.allele1.end());
+	allele2.insert(allele2.end(), other.allele2.begin(), other.allele2.end());
+	confidence.insert(confidence.end(), other.confidence.begin(), other.confidence.end());
+	depth.insert(depth.end(), other.depth.begin(), other.depth.end());
+	reads.insert(reads.end(), other.reads.begin(), other.reads.end());
+	starred.insert(starred.end(), other.starred.begin(), other.starred.end());
+	mapQ.insert(mapQ.end(), other.mapQ.begin(), other.mapQ.end());
+	concordance.insert(concordance.end(), other.concordance.begin(), other.concordance.end());
+	timeout.insert(timeout.end(), other.timeout.begin(), other.timeout.end());
+	histogramSize.insert(histogramSize.end(), other.histogramSize.begin(), other.histogramSize.end());
+	histogramLength.insert(histogramLength.end(), other.histogramLength.begin(), other.histogramLength.end());
+	histogramReads.insert(histogramReads.end(), other.histogramReads.begin(), other.histogramReads.end());
+}
+
+//ENCODING:
+inline void putVarint(string &out, uint64_t value){
+	while (value >= 0x80) {
+		out += char((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += char(value);
+}
+
+inline void putSigned(string &out, int64_t value){
+	putVarint(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+template <typename T>
+inline void putRaw(string &out, T value){
+	out.append((const char*) &value, sizeof(T));
+}
+
+inline void putFloat(string &out, double value){
+	putRaw(out, float(value));
+}
+
+inline void putString(string &out, const string &value, const string &previous){
+	size_t shared = 0;
+	while (shared < value.length() && shared < previous.length() && value[shared] == previous[shared]) ++shared;
+	putVarint(out, shared);
+	putVarint(out, value.length() - shared);
+	out.append(value, shared, string::npos);
+}
+
+//encode rows [first,last) of a column (entries [first,last) of the histogram for its columns)
+string encodeColumn(const RESULT_COLUMNS &results, int column, size_t first, size_t last){
+	string out;
+	for (size_t row = first; row < last; ++row) {
+		switch (column) {
+			case COL_LINE: putSigned(out, int64_t(results.line[row]) - (row > first ? int64_t(results.line[row-1]) : 0)); break;
+			case COL_REGION: putString(out, results.region[row], row > first ? results.region[row-1] : ""); break;
+			case COL_GENOTYPE: putString(out, results.genotype[row], row > first ? results.genotype[row-1] : ""); break;
+			case COL_ALLELE1: putSigned(out, results.allele1[row]); break;
+			case COL_ALLELE2: putSigned(out, results.allele2[row]); break;
+			case COL_CONFIDENCE: putFloat(out, results.confidence[row]); break;
+			case COL_DEPTH: putSigned(out, results.depth[row]); break;
+			case COL_READS: putSigned(out, results.reads[row]); break;
+			case COL_STARRED: putSigned(out, results.starred[row]); break;
+			case COL_MAPQ: putFloat(out, results.mapQ[row]); break;
+			case COL_CONCORDANCE: putFloat(out, results.concordance[row]); break;
+			case COL_TIMEOUT: out += char(results.timeout[row]); break;
+			case COL_HISTOGRAM_SIZE: putSigned(out, results.histogramSize[row]); break;
+			case COL_HISTOGRAM_LENGTH: putSigned(out, results.histogramLength[row]); break;
+			case COL_HISTOGRAM_READS: putSigned(out, results.histogramReads[row]); break;
+		}
+	}
+	return out;
+}
+
+//split values of width bytes into byte planes (or join them back)
+string transposeBytes(const string &in, size_t width, bool join){
+	string out(in.length(), '\0');
+	size_t count = in.length() / width;
+	for (size_t i = 0; i < count; ++i)
+		for (size_t byte = 0; byte < width; ++byte) {
+			if (join) out[i * width + byte] = in[byte * count + i];
+			else out[byte * count + i] = in[i * width + byte];
+		}
+	return out;
+}
+
+//deflate an encoded chunk
+string deflateChunk(const string &chunk){
+	uLongf bytes = compressBound(chunk.length());
+	string compressed(bytes, '\0');
+	if (compress2((Bytef*) &compressed[0], &bytes, (const Bytef*) chunk.data(), chunk.length(), COLUMN_COMPRESSION) != Z_OK)
+		throw "Could not compress columns chunk.";
+	compressed.resize(bytes);
+	return compressed;
+}
+
+//write the results of the workers, in order, to a columns file
+bool writeColumns(string filename, const vector<worker_data_t *> &workers){
+	RESULT_COLUMNS results;
+	for (size_t thread = 0; thread < workers.size(); ++thread) results.append(workers[thread]->columns);
+
+	ofstream out(filename.c_str(), ios::out | ios::binary);
+	if (!out.is_open()) return false;
+	string header(COLUMN_MAGIC);
+	putRaw(header, uint32_t(COLUMN_VERSION));
+	out << header;
+	uint64_t offset = header.length();
+
+	string footer;
+	putRaw(footer, uint32_t(NUM_COLUMNS));
+	for (int column = 0; column < NUM_COLUMNS; ++column) {
+		footer += char(strlen(COLUMN_NAMES[column]));
+		footer += COLUMN_NAMES[column];
+		footer += COLUMN_TYPES[column];
+	}
+
+	size_t rows = results.line.size();
+	putRaw(footer, uint32_t((rows + COLUMN_GROUP_ROWS - 1) / COLUMN_GROUP_ROWS));
+	size_t entry = 0;       //first histogram entry of the group
+	for (size_t first = 0; first < rows; first += COLUMN_GROUP_ROWS) {
+		size_t last = min(rows, first + COLUMN_GROUP_ROWS), entries = 0;
+		for (size_t row = first; row < last; ++row) entries += results.histogramSize[row];
+		putRaw(footer, uint64_t(first));
+		putRaw(footer, uint32_t(last - first));
+		putRaw(footer, uint32_t(entries));
+		for (int column = 0; column < NUM_COLUMNS; ++column) {
+			bool histogram = (column == COL_HISTOGRAM_LENGTH || column == COL_HISTOGRAM_READS);
+			string chunk = histogram ? encodeColumn(results, column, entry, entry + entries) : encodeColumn(results, column, first, last);
+			if (COLUMN_TYPES[column] == 'f') chunk = transposeBytes(chunk, sizeof(float), false);
+			string compressed = deflateChunk(chunk);
+			out << compressed;
+			putRaw(footer, offset);
+			putRaw(footer, uint64_t(compressed.length()));
+			putRaw(footer, uint64_t(chunk.length()));
+			offset += compressed.length();
+		}
+		entry += entries;
+	}
+
+	out << footer;
+	string trailer;
+	putRaw(trailer, offset);
+	trailer += COLUMN_MAGIC;
+	out << trailer;
+	out.close();
+	return !out.fail();
+}
+
+//DECODING:
+inline uint64_t getVarint(const string &in, size_t &pos){
+	uint64_t value = 0;
+	for (int shift = 0; pos < in.length(); shift += 7) {
+		unsigned char c = in[pos++];
+		value |= uint64_t(c & 0x7f) << shift;
+		if (!(c & 0x80)) break;
+	}
+	return value;
+}
+
+inline int64_t getSigned(const string &in, size_t &pos){
+	uint64_t value = getVarint(in, pos);
+	return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+template <typename T>
+inline T getRaw(const string &in, size_t &pos){
+	T value = T();
+	if (pos + sizeof(T) <= in.length()) memcpy(&value, in.data() + pos, sizeof(T));
+	pos += sizeof(T);
+	return value;
+}
+
+bool ColumnReader::open(string filename){
+	columns.clear();
+	types.clear();
+	groups.clear();
+	rows = 0;
+	in.open(filename.c_str(), ios::in | ios::binary);
+	if (!in.is_open()) return false;
+
+	string head = read(0, 8), tail;
+	in.seekg(0, ios::end);
+	uint64_t size = in.tellg();
+	if (size < 20 || head.compare(0, 4, COLUMN_MAGIC) != 0) return false;
+	size_t pos = 4;
+	if (getRaw<uint32_t>(head, pos) != COLUMN_VERSION) return false;
+	tail = read(size - 12, 12);
+	if (tail.compare(8, 4, COLUMN_MAGIC) != 0) return false;
+	pos = 0;
+	uint64_t footerOffset = getRaw<uint64_t>(tail, pos);
+	if (footerOffset > size - 12) return false;
+	string footer = read(footerOffset, size - 12 - footerOffset);
+
+	pos = 0;
+	uint32_t numColumns = getRaw<uint32_t>(footer, pos);
+	for (uint32_t column = 0; column < numColumns && pos < footer.length(); ++column) {
+		size_t length = (unsigned char) footer[pos++];
+		columns.push_back(footer.substr(pos, length));
+		pos += length;
+		types += footer[pos++];
+	}
+	uint32_t numGroups = getRaw<uint32_t>(footer, pos);
+	for (uint32_t group = 0; group < numGroups && pos < footer.length(); ++group) {
+		GROUP g;
+		g.first = getRaw<uint64_t>(footer, pos);
+		g.rows = getRaw<uint32_t>(footer, pos);
+		g.entries = getRaw<uint32_t>(footer, pos);
+		for (size_t column = 0; column < columns.size(); ++column) {
+			uint64_t offset = getRaw<uint64_t>(footer, pos);
+			g.chunks.push_back(make_pair(offset, getRaw<uint64_t>(footer, pos)));
+			g.encoded.push_back(getRaw<uint64_t>(footer, pos));
+		}
+		rows = g.first + g.rows;
+		groups.push_back(g);
+	}
+	return pos <= footer.length();
+}
+
+int ColumnReader::column(const string &name) const {
+	for (size_t column = 0; column < columns.size(); ++column)
+		if (columns[column] == name) return column;
+	return -1;
+}
+
+string ColumnReader::read(uint64_t offset, uint64_t bytes){
+	string data(bytes, '\0');
+	in.clear();
+	in.seekg(offset);
+	if (bytes) in.read(&data[0], bytes);
+	return data;
+}
+
+//decode a column of a group, each value as text ("NA" for missing values)
+vector<string> ColumnReader::decode(size_t group, int column){
+	const GROUP &g = groups[group];
+	string compressed = read(g.chunks[column].first, g.chunks[column].second);
+	uLongf bytes = g.encoded[column];
+	string chunk(bytes, '\0');
+	if (bytes && uncompress((Bytef*) &chunk[0], &bytes, (const Bytef*) compressed.data(), compressed.length()) != Z_OK) bytes = 0;
+	chunk.resize(bytes);
+	if (types[column] == 'f') chunk = transposeBytes(chunk, sizeof(float), true);
+	size_t count = (columns[column] == "histogram_length" || columns[column] == "histogram_reads") ? g.entries : g.rows;
+	vector<string> values;
+	values.reserve(count);
+	int64_t line = 0;
+	string previous;
+	size_t pos = 0;
+	for (size_t i = 0; i < count; ++i) {
+		stringstream value;
+		switch (types[column]) {
+			case 'd':
+				line += getSigned(chunk, pos);
+				value << line;
+				break;
+			case 'i': {
+				int64_t v = getSigned(chunk, pos);
+				if (v < 0) value << "NA";
+				else value << v;
+				break;
+			}
+			case 'f': {
+				float v = getRaw<float>(chunk, pos);
+				if (v != v) value << "NA";
+				else value << v;
+				break;
+			}
+			case 'b':
+				value << int((unsigned char) chunk[pos++]);
+				break;
+			case 's': {
+				size_t shared = getVarint(chunk, pos), length = getVarint(chunk, pos);
+				previous = previous.substr(0, shared) + chunk.substr(pos, length);
+				pos += length;
+				if (previous == "") value << "NA";
+				else value << previous;
+				break;
+			}
+		}
+		values.push_back(value.str());
+	}
+	return values;
+}
+
+//repeatseq columns <file> [-rows FROM:TO] [column ...]: print columns of a row range as text
+int printColumns(int argc, char* argv[]){
+	if (argc < 3) {
+		cout << "Usage: repeatseq columns <columns file> [-rows FROM:TO] [column ...]" << endl;
+		return 0;
+	}
+	ColumnReader reader;
+	if (!reader.open(argv[2])) {
+		cout << "Unable to read columns file " << argv[2] << endl;
+		return 0;
+	}
+
+	//the columns asked for ("histogram" for the histogram as LENGTH[READS] ...), or all of them
+	uint64_t from = 0, to = reader.rows;
+	vector<string> names;
+	for (int i = 3; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "-rows" && i + 1 < argc) {
+			string range = argv[++i];
+			size_t colon = range.find(':');
+			from = strtoull(range.substr(0, colon).c_str(), NULL, 10);
+			if (colon != string::npos) to = min(to, (uint64_t) strtoull(range.substr(colon+1).c_str(), NULL, 10));
+		}
+		else if (arg == "histogram" || reader.column(arg) >= 0) names.push_back(arg);
+		else {
+			cout << "No column " << arg << " in " << argv[2] << endl;
+			return 0;
+		}
+	}
+	if (names.empty()) {
+		for (size_t column = 0; column < reader.columns.size(); ++column)
+			if (reader.columns[column].compare(0, 9, "histogram") != 0) names.push_back(reader.columns[column]);
+		names.push_back("histogram");
+	}
+
+	for (size_t i = 0; i < names.size(); ++i) cout << (i ? "\t" : "") << names[i];
+	cout << '\n';
+
+	//only the groups overlapping the rows are read
+	for (size_t group = 0; group < reader.groups.size(); ++group) {
+		const ColumnReader::GROUP &g = reader.groups[group];
+		if (g.first + g.rows <= from || g.first >= to) continue;
+		vector<vector<string> > values(names.size());
+		for (size_t i = 0; i < names.size(); ++i) {
+			if (names[i] != "histogram") {
+				values[i] = reader.decode(group, reader.column(names[i]));
+				continue;
+			}
+			int sizeColumn = reader.column("histogram_size"), lengthColumn = reader.column("histogram_length"), readsColumn = reader.column("histogram_reads");
+			if (sizeColumn < 0 || lengthColumn < 0 || readsColumn < 0) {
+				values[i].assign(g.rows, "NA");
+				continue;
+			}
+			vector<string> sizes = reader.decode(group, sizeColumn), lengths = reader.decode(group, lengthColumn), reads = reader.decode(group, readsColumn);
+			size_t entry = 0;
+			for (size_t row = 0; row < g.rows; ++row) {
+				string histogram;
+				for (int n = atoi(sizes[row].c_str()); n > 0 && entry < lengths.size(); --n, ++entry)
+					histogram += (histogram == "" ? "" : " ") + lengths[entry] + "[" + reads[entry] + "]";
+				values[i].push_back(histogram == "" ? "NA" : histogram);
+			}
+		}
+		for (uint64_t row = max(from, g.first); row < min(to, g.first + g.rows); ++row) {
+			for (size_t i = 0; i < names.size(); ++i) cout << (i ? "\t" : "") << values[i][row - g.first];
+			cout << '\n';
+		}
+	}
+	return 0;
+}
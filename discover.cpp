@@ -0,0 +1,299 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Discover module: building a region file directly from a FASTA file ("repeatseq discover")
+//
+// Each contig is scanned once for each repeat unit length (period) from 1 to -maxunit: the bases
+// matching the base a period further on are marked in a single pass over the contig (a loop the
+// compiler vectorizes), & the marks are scored as TRF does (+2 a match, -7 a mismatch), keeping
+// the stretches scoring at least -minscore before dropping XDROP below their best.  A stretch
+// whose consensus unit is itself repeated is left to the shorter period.  Overlapping stretches
+// of different periods are resolved to the higher score (the shorter period on a tie).  Indels
+// within a repeat are not modelled: a stretch ends where one shifts the phase of its units.
+//
+// Each locus is printed as a line of a region file, in the contig order of the FASTA index:
+//   chr:start-stop <tab> period_copies_unitlength_%matches_%indels_score_%A_%C_%G_%T_entropy_unit
+// the fields initLocus() reads from TRF's output.  Contigs are shared among -threads threads.
+//
+// A contig is read DISCOVER_WINDOW bases at a time rather than whole, so memory doesn't grow with
+// contig length times -threads.  The scan of each period stops at the end of the bases read &
+// resumes with the next window, carrying a stretch still open across it; bases are kept only from
+// the start of the earliest open stretch (or the next base to scan) on.
+
+#include "repeatseq.h"
+#include <algorithm>
+#include <unistd.h>
+
+#define MATCH_SCORE 2
+#define MISMATCH_SCORE 7
+#define XDROP 21
+#define DISCOVER_WINDOW 1048576     // bases of a contig read at a time
+
+//a repeat found on a contig (0-based, stop exclusive):
+struct REPEAT_CANDIDATE {
+	int start, stop;
+	int period, score;
+	double purity;
+	string unit;
+	int counts[4];                      // A, C, G & T bases of the stretch
+
+	static bool byScore(const REPEAT_CANDIDATE &a, const REPEAT_CANDIDATE &b){
+		if (a.score != b.score) return a.score > b.score;
+		if (a.period != b.period) return a.period < b.period;
+		return a.start < b.start;
+	}
+	static bool byStart(const REPEAT_CANDIDATE &a, const REPEAT_CANDIDATE &b){ return a.start < b.start; }
+};
+
+struct DISCOVER_SETTINGS {
+	int maxUnit;
+	int minScore;
+	double minPurity;
+	int threads;
+
+	DISCOVER_SETTINGS(){
+		maxUnit = 6;
+		minScore = 12;
+		minPurity = 0;
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+};
+
+//where the scan of a contig at a period stopped (contig positions):
+struct PERIOD_SCAN {
+	bool open;                          // a stretch is open
+	int score, best;
+	size_t start, bestEnd;
+	size_t next;                        // next position to scan
+
+	PERIOD_SCAN() : open(false), score(0), best(0), start(0), bestEnd(0), next(0) {}
+};
+
+typedef struct {
+	string fasta_file;
+	const vector<string> * contigs;
+	vector<string> * output;                // region file lines of each contig
+	int * next;                             // next contig to scan (taken with __sync builtins)
+	const DISCOVER_SETTINGS * settings;
+	pthread_t thread;
+} discover_data_t;
+
+//mark the bases equal to the base a period further on (never an N)
+void periodMatches(const string &sequence, int period, vector<unsigned char> &match){
+	size_t n = sequence.length() > size_t(period) ? sequence.length() - period : 0;
+	match.resize(n);
+	const unsigned char *s = (const unsigned char *) sequence.data();
+	unsigned char *m = n ? &match[0] : NULL;
+	for (size_t i = 0; i < n; ++i) m[i] = (s[i] == s[i + period]) & (s[i] != 'N');
+}
+
+//the consensus unit of a stretch: the most common base at each phase
+string consensusUnit(const string &sequence, int start, int stop, int period){
+	string unit(period, 'N');
+	for (int phase = 0; phase < period; ++phase) {
+		int counts[4] = { 0, 0, 0, 0 };
+		for (int i = start + phase; i < stop; i += period) {
+			switch (sequence[i]) {
+				case 'A': ++counts[0]; break;
+				case 'C': ++counts[1]; break;
+				case 'G': ++counts[2]; break;
+				case 'T': ++counts[3]; break;
+			}
+		}
+		int best = max_element(counts, counts + 4) - counts;
+		if (counts[best]) unit[phase] = "ACGT"[best];
+	}
+	return unit;
+}
+
+//true if a unit is itself a repeat of a shorter unit
+bool isCompoundUnit(const string &unit){
+	int period = unit.length();
+	for (int shorter = 1; shorter < period; ++shorter) {
+		if (period % shorter) continue;
+		bool repeats = true;
+		for (int i = shorter; i < period && repeats; ++i) repeats = unit[i] == unit[i - shorter];
+		if (repeats) return true;
+	}
+	return false;
+}
+
+//the stretches of a contig repeating at a period, scanned from where scan stopped to the end of
+//the bases read (sequence, which starts at contig position offset); last if they end the contig
+void findRepeats(const string &sequence, size_t offset, bool last, int period, PERIOD_SCAN &scan, vector<unsigned char> &match, vector<REPEAT_CANDIDATE> &candidates, const DISCOVER_SETTINGS &settings){
+	periodMatches(sequence, period, match);
+	size_t n = offset + match.size();       //positions marked so far
+	bool &open = scan.open;
+	int &score = scan.score, &best = scan.best;
+	size_t &start = scan.start, &bestEnd = scan.bestEnd;
+	size_t i = scan.next;
+	for (; i <= n; ++i) {
+		if (i == n && !last) break;     //resumed with the next window
+		if (i < n && !open) {
+			if (!match[i - offset]) continue;
+			open = true;
+			start = i;
+			score = best = 0;
+		}
+		if (i < n) {
+			score += match[i - offset] ? MATCH_SCORE : -MISMATCH_SCORE;
+			if (score > best) {
+				best = score;
+				bestEnd = i + 1;
+			}
+			if (score > 0 && best - score <= XDROP) continue;
+		}
+		if (!open) break;
+		open = false;
+
+		//the stretch covers the bases of its marks & the period after them
+		REPEAT_CANDIDATE candidate;
+		candidate.start = start;
+		candidate.stop = bestEnd + period;
+		candidate.period = period;
+		candidate.score = best;
+		candidate.purity = double(count(match.begin() + (start - offset), match.begin() + (bestEnd - offset), 1)) / (bestEnd - start);
+		i = bestEnd;    //the loop continues after the mismatch ending the stretch
+		if (best < settings.minScore || candidate.purity < settings.minPurity || candidate.stop - candidate.start < 2 * period) continue;
+		candidate.unit = consensusUnit(sequence, candidate.start - offset, candidate.stop - offset, period);
+		if (candidate.unit.find('N') != string::npos || isCompoundUnit(candidate.unit)) continue;
+		fill(candidate.counts, candidate.counts + 4, 0);
+		for (int j = candidate.start - offset; j < candidate.stop - int(offset); ++j) {
+			switch (sequence[j]) {
+				case 'A': ++candidate.counts[0]; break;
+				case 'C': ++candidate.counts[1]; break;
+				case 'G': ++candidate.counts[2]; break;
+				case 'T': ++candidate.counts[3]; break;
+			}
+		}
+		candidates.push_back(candidate);
+	}
+	scan.next = i;
+}
+
+//the region file line of a repeat, in TRF's format
+string formatRepeat(const string &contig, const REPEAT_CANDIDATE &repeat){
+	int length = repeat.stop - repeat.start;
+	const int *counts = repeat.counts;
+	double entropy = 0;
+	for (int base = 0; base < 4; ++base) {
+		double p = double(counts[base]) / length;
+		if (p > 0) entropy -= p * log(p) / log(2.0);
+	}
+
+	stringstream line;
+	line << contig << ':' << repeat.start + 1 << '-' << repeat.stop << '\t';
+	line << repeat.period << '_' << setiosflags(ios::fixed) << setprecision(1) << double(length) / repeat.period << '_';
+	line << repeat.period << '_' << int(100 * repeat.purity + 0.5) << "_0_" << repeat.score;
+	for (int base = 0; base < 4; ++base) line << '_' << 100 * counts[base] / length;
+	line << '_' << setprecision(2) << entropy << '_' << repeat.unit << '\n';
+	return line.str();
+}
+
+//the region file lines of a contig
+string discoverContig(const string &contig, FastaReference &fr, const DISCOVER_SETTINGS &settings){
+	size_t length = fr.sequenceLength(contig);
+	string sequence;                        // the bases from contig position offset on that are still needed
+	size_t offset = 0;
+	vector<unsigned char> match;
+	vector<PERIOD_SCAN> scans(settings.maxUnit + 1);
+	vector<REPEAT_CANDIDATE> candidates;
+	for (size_t read = 0; read < length || read == 0; ) {
+		size_t size = min<size_t>(DISCOVER_WINDOW, length - read);
+		string window = size ? fr.getSubSequence(contig, read, size) : "";
+		upperCase(window);
+		sequence += window;
+		read += size;
+		bool last = read >= length;
+		size_t keep = read;
+		for (int period = 1; period <= settings.maxUnit; ++period) {
+			findRepeats(sequence, offset, last, period, scans[period], match, candidates, settings);
+			keep = min(keep, scans[period].open ? scans[period].start : scans[period].next);
+		}
+		if (last) break;
+		sequence.erase(0, keep - offset);
+		offset = keep;
+	}
+
+	//the best of overlapping repeats is kept:
+	sort(candidates.begin(), candidates.end(), REPEAT_CANDIDATE::byScore);
+	map<int,int> taken;     //start -> stop of the repeats kept
+	vector<REPEAT_CANDIDATE> kept;
+	for (vector<REPEAT_CANDIDATE>::iterator it = candidates.begin(); it < candidates.end(); ++it) {
+		map<int,int>::iterator next = taken.lower_bound(it->start);
+		if (next != taken.end() && next->first < it->stop) continue;
+		if (next != taken.begin() && (--next)->second > it->start) continue;
+		taken[it->start] = it->stop;
+		kept.push_back(*it);
+	}
+	sort(kept.begin(), kept.end(), REPEAT_CANDIDATE::byStart);
+
+	string lines;
+	for (vector<REPEAT_CANDIDATE>::iterator it = kept.begin(); it < kept.end(); ++it) lines += formatRepeat(contig, *it);
+	return lines;
+}
+
+void * discover_thread(void * pdata){
+	discover_data_t & data = *((discover_data_t *) pdata);
+	FastaReference fr;
+	fr.open(data.fasta_file);
+	for (int contig = __sync_fetch_and_add(data.next, 1); contig < int(data.contigs->size()); contig = __sync_fetch_and_add(data.next, 1)) {
+		const string &name = (*data.contigs)[contig];
+		(*data.output)[contig] = discoverContig(name, fr, *data.settings);
+	}
+	return NULL;
+}
+
+//repeatseq discover <in.fasta> [options]: print a region file of the tandem repeats of a FASTA file
+int discoverRepeats(int argc, char* argv[]){
+	if (argc < 3) {
+		cout << "Usage: repeatseq discover <in.fasta> [-maxunit N] [-minscore N] [-minpurity F] [-threads N] > out.regions" << endl;
+		return 0;
+	}
+	string fasta_file = argv[2];
+	DISCOVER_SETTINGS settings;
+	for (int i = 3; i + 1 < argc; i += 2) {
+		string sw = argv[i];
+		if (sw == "-maxunit") settings.maxUnit = atoi(argv[i+1]);
+		else if (sw == "-minscore") settings.minScore = atoi(argv[i+1]);
+		else if (sw == "-minpurity") settings.minPurity = atof(argv[i+1]);
+		else if (sw == "-threads") settings.threads = atoi(argv[i+1]);
+		else {
+			cerr << "Unknown option " << sw << endl;
+			return 1;
+		}
+	}
+	if (settings.threads < 1) settings.threads = 1;
+
+	FastaIndex fai;
+	if (!fileCheck(fasta_file + fai.indexFileExtension())) {
+		cerr << "Fasta index file not found, creating..." << endl;
+		buildFastaIndex(fasta_file);
+	}
+	FastaReference fr;
+	fr.open(fasta_file);
+	vector<string> contigs = fr.index->sequenceNames;
+	vector<string> output(contigs.size());
+	int next = 0;
+
+	vector<discover_data_t> threads(min<size_t>(settings.threads, max<size_t>(contigs.size(), 1)));
+	for (size_t thread = 0; thread < threads.size(); ++thread) {
+		discover_data_t &data = threads[thread];
+		data.fasta_file = fasta_file;
+		data.contigs = &contigs;
+		data.output = &output;
+		data.next = &next;
+		data.settings = &settings;
+		if (0 != pthread_create(&data.thread, NULL, discover_thread, &data)) {
+			perror("Error creating discover thread");
+			return 1;
+		}
+	}
+	for (size_t thread = 0; thread < threads.size(); ++thread)
+		if (0 != pthread_join(threads[thread].thread, NULL)) perror("Error closing discover thread");
+
+	for (vector<string>::iterator it = output.begin(); it < output.end(); ++it) cout << *it;
+	cout << flush;
+	return 0;
+}
@@ -0,0 +1,200 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Dry run module: estimates the wall time & memory of a run from the region file & BAM index
+//
+// The reads of each locus, & of each run of neighbouring loci read together by scanLoci(), are
+// estimated from the BAM index (see bamindex.cpp).  A locus costs LOCUS_COST microseconds plus
+// -readcost microseconds for each read of its run (shared among the loci of the run); the wall
+// time for a number of threads is that of the slowest of the equal shares of the region file
+// main() hands the workers.  Memory is the region file, the output the workers hold until it is
+// consolidated (the .repeatseq file holds a line per read) & the reads each worker holds for its
+// deepest locus.  The estimates of each locus are written to <in.bam>.estimates; no genotyping
+// is done.  -threadstats prints the per-read cost of a finished run, to calibrate -readcost.
+//
+// The index only bounds the reads of a locus from the compressed bytes of its 16kb windows & a
+// read length of MAX_READ_SIZE, so the reads of DRY_RUN_SAMPLES loci spread over the region file
+// are counted in the BAM file & the estimates are scaled by the ratio of the reads counted to
+// the reads estimated for them; the ratio is printed with the report.
+
+#include "repeatseq.h"
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//microseconds of fixed cost per locus (parsing the line, fetching its reference, genotyping):
+#define LOCUS_COST 30
+
+//bytes of output per locus (VCF record, .calls line, .repeatseq header) & per .repeatseq read line:
+#define VCF_BYTES 150
+#define CALLS_BYTES 60
+#define REPEATSEQ_LOCUS_BYTES 200
+#define REPEATSEQ_READ_BYTES 48
+
+//bytes per worker (BAM & FASTA readers, buffers) & per read held for a locus or in a deep batch:
+#define WORKER_BYTES (1 << 20)
+#define READ_OVERHEAD_BYTES 400
+
+//loci whose reads are counted in the BAM file to check the estimates of the index:
+#define DRY_RUN_SAMPLES 64
+
+//the thread counts estimated, besides the processors of this machine:
+const int DRY_RUN_THREADS[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+//format bytes as e.g. 1.5 GB
+string formatBytes(double bytes){
+	const char *units[] = { "B", "KB", "MB", "GB", "TB" };
+	int unit = 0;
+	while (bytes >= 1024 && unit < 4) {
+		bytes /= 1024;
+		++unit;
+	}
+	stringstream out;
+	out << setiosflags(ios::fixed) << setprecision(unit ? 1 : 0) << bytes << ' ' << units[unit];
+	return out.str();
+}
+
+//estimated peak memory of a run with num_threads workers
+double estimateMemory(const vector<double> &outputBytes, const vector<double> &lociReads, double fixedBytes, int num_threads, const SETTINGS_FILTERS &settings){
+	size_t n = outputBytes.size();
+	double readBytes = 2 * settings.MAX_READ_SIZE + READ_OVERHEAD_BYTES;
+	double total = fixedBytes;
+	for (int thread = 0; thread != num_threads; thread++) {
+		size_t first = thread * (n / num_threads);
+		size_t last = (thread == num_threads - 1) ? n : (thread+1) * (n / num_threads);
+		double output = 0, deepest = 0;
+		for (size_t i = first; i < last; ++i) {
+			output += outputBytes[i];
+			deepest = max(deepest, lociReads[i]);
+		}
+		//stringstreams grow by doubling; a deep locus also holds a batch of reads
+		total += WORKER_BYTES + 2 * output + deepest * readBytes;
+		if (settings.deepReads && deepest >= settings.deepReads) total += DEEP_BATCH_SIZE * readBytes;
+	}
+	return total;
+}
+
+int dryRun(const SETTINGS_FILTERS &settings, const string &bam_file, const string &bam_index_file, const vector<string> &regions){
+	BamReader reader;
+	if (!reader.Open(bam_file)) { throw "Could not open BAM file.."; }
+	BaiIndex index;
+	if (!index.load(bam_index_file)) { throw "Could not open BAM index file.."; }
+
+	size_t n = regions.size();
+
+	//the reads counted against the reads estimated for a sample of the loci:
+	double counted = 0, sampled = 0;
+	for (size_t s = 0; s < min<size_t>(n, DRY_RUN_SAMPLES); ++s) {
+		const string &line = regions[s * n / min<size_t>(n, DRY_RUN_SAMPLES)];
+		string region = line.substr(0, line.find('\t'));
+		Region target(region);
+		int refID = reader.GetReferenceID(target.startSeq);
+		if (refID < 0) continue;
+		BamAlignment al;
+		if (!reader.SetRegion(BamRegion(refID, target.startPos - 1, refID, target.stopPos))) continue;
+		sampled += index.estimateReads(refID, target.startPos - 1, target.stopPos - 1, settings.MAX_READ_SIZE);
+		while (reader.GetNextAlignmentCore(al)) ++counted;
+	}
+	double scale = sampled > 0 ? counted / sampled : 1;
+
+	vector<double> lociReads(n, 0), cost(n, LOCUS_COST), outputBytes(n, 0);
+	double regionBytes = 0, totalReads = 0;
+	size_t deepest = 0;
+
+	//runs of loci are grouped as in scanRegions(): same chromosome, in order, within a read length
+	size_t runStart = 0;
+	int runRefID = -1, runFirst = 0, runLeft = 0, runRight = 0;     //runFirst: left of the run's first locus
+	for (size_t i = 0; i <= n; ++i) {
+		Region target;
+		int refID = -1, left = 0, right = 0;
+		if (i < n) {
+			regionBytes += regions[i].capacity() + sizeof(string);
+			string region = regions[i].substr(0, regions[i].find('\t'));
+			target = Region(region);
+			refID = reader.GetReferenceID(target.startSeq);
+			left = target.startPos - 1;
+			right = target.stopPos - 1;
+		}
+
+		bool sameRun = i < n && i > runStart && refID == runRefID && left >= runLeft && left <= runRight + settings.MAX_READ_SIZE;
+		if (i > runStart && !sameRun) {
+			double runReads = scale * index.estimateReads(runRefID, runFirst, runRight, settings.MAX_READ_SIZE);
+			totalReads += runReads;
+			for (size_t j = runStart; j < i; ++j) cost[j] += settings.readCost * runReads / (i - runStart);
+			runStart = i;
+		}
+		if (i == n) break;
+		if (i == runStart) {
+			runFirst = left;
+			runRight = right;
+		}
+		runRefID = refID;
+		runLeft = left;
+		runRight = max(runRight, right);
+
+		lociReads[i] = scale * index.estimateReads(refID, left, right, settings.MAX_READ_SIZE);
+		if (lociReads[i] > lociReads[deepest]) deepest = i;
+		outputBytes[i] = VCF_BYTES;
+		if (settings.makeCallsFile) outputBytes[i] += CALLS_BYTES;
+		if (settings.makeRepeatseqFile)
+			outputBytes[i] += REPEATSEQ_LOCUS_BYTES + lociReads[i] * (2 * settings.LR_CHARS_TO_PRINT + target.length() + REPEATSEQ_READ_BYTES);
+	}
+
+	//estimates of each locus:
+	string estimates_filename = setToCD(bam_file + settings.paramString + ".estimates");
+	ofstream estimates(estimates_filename.c_str());
+	estimates << "region\treads\tcost(us)\toutput(bytes)\n";
+	estimates << setiosflags(ios::fixed) << setprecision(0);
+	for (size_t i = 0; i < n; ++i)
+		estimates << regions[i].substr(0, regions[i].find('\t')) << '\t' << lociReads[i] << '\t' << cost[i] << '\t' << outputBytes[i] << '\n';
+	estimates.close();
+
+	//the index is held in memory when deep loci are shared:
+	double fixedBytes = regionBytes;
+	struct stat indexStat;
+	if (settings.deepReads && stat(bam_index_file.c_str(), &indexStat) == 0) fixedBytes += indexStat.st_size;
+
+	vector<int> threadCounts(DRY_RUN_THREADS, DRY_RUN_THREADS + sizeof(DRY_RUN_THREADS) / sizeof(int));
+	int processors = sysconf(_SC_NPROCESSORS_ONLN);
+	if (find(threadCounts.begin(), threadCounts.end(), processors) == threadCounts.end()) threadCounts.push_back(processors);
+	sort(threadCounts.begin(), threadCounts.end());
+
+	stringstream report;
+	report << setiosflags(ios::fixed) << setprecision(1);
+	report << "dry run: " << n << " loci, ~" << setprecision(0) << totalReads << " reads to read from " << bam_file << setprecision(1);
+	report << " (" << (n ? totalReads / n : 0) << " per locus";
+	if (n) report << ", deepest " << regions[deepest].substr(0, regions[deepest].find('\t')) << " with ~" << setprecision(0) << lociReads[deepest];
+	report << "); estimates per locus in " << estimates_filename << "\n";
+	report << "index estimates scaled by " << setprecision(2) << scale << setprecision(1) << " (" << setprecision(0) << counted;
+	report << " reads counted in the BAM file for " << min<size_t>(n, DRY_RUN_SAMPLES) << " sampled loci)\n" << setprecision(1);
+	report << "cost model: " << settings.readCost << "us per read, " << LOCUS_COST << "us per locus (calibrate -readcost with -threadstats)\n";
+	report << "threads\twall time\tefficiency\tpeak memory\n";
+
+	double serial = 0;
+	for (size_t i = 0; i < n; ++i) serial += cost[i];
+	vector<double> wall(threadCounts.size(), 0), memory(threadCounts.size(), 0);
+	size_t best = 0, recommended = 0;
+	for (size_t t = 0; t < threadCounts.size(); ++t) {
+		int num_threads = threadCounts[t];
+		for (int thread = 0; thread != num_threads; thread++) {
+			size_t first = thread * (n / num_threads);
+			size_t last = (thread == num_threads - 1) ? n : (thread+1) * (n / num_threads);
+			double share = 0;
+			for (size_t i = first; i < last; ++i) share += cost[i];
+			wall[t] = max(wall[t], share / 1e6);
+		}
+		memory[t] = estimateMemory(outputBytes, lociReads, fixedBytes, num_threads, settings);
+		if (wall[t] < wall[best]) best = t;
+		report << num_threads << (num_threads == processors ? "*" : "") << '\t' << formatTime(wall[t]) << "\t\t";
+		report << (wall[t] > 0 ? 100 * serial / 1e6 / (num_threads * wall[t]) : 100.0) << "%\t\t" << formatBytes(memory[t]) << '\n';
+	}
+
+	//the fewest threads within 10% of the fastest; limits carry a margin for the estimates
+	while (wall[recommended] > 1.1 * wall[best]) ++recommended;
+	report << "(* the processors of this machine; repeatseq starts a worker per online processor)\n";
+	report << "recommendation: " << threadCounts[recommended] << " cores, wall time limit " << formatTime(1.5 * wall[recommended] + 60);
+	report << ", memory " << formatBytes(1.25 * memory[recommended]) << '\n';
+	cout << report.str() << flush;
+	return 0;
+}
@@ -0,0 +1,61 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Families module: collapsing PCR-duplicate & UMI read families before genotyping (-families, -umi)
+//
+// With -families, addRead() keys each read it keeps on its family: the reads of one molecule
+// start at the same position on the same strand, with their mates at the same position.  With
+// -umi TAG, reads carrying the tag are keyed on its value & the start of their fragment instead
+// (so both mates of a molecule & all of their duplicates are one family); reads without it fall
+// back to their position.  Before a locus is genotyped, each family is collapsed to a single
+// observation: the allele length most of its reads have (the first read's on a tie), carried by
+// the first read of that length.  Only those reads are expanded, printed & genotyped.
+
+#include "repeatseq.h"
+#include <algorithm>
+
+//the key of a read's family
+string familyKey(const BamAlignment &al, const SETTINGS_FILTERS &settings){
+	stringstream key;
+	string umi;
+	if (!settings.umiTag.empty() && al.GetTag(settings.umiTag, umi)) {
+		int fragmentStart = al.Position;
+		if (al.IsPaired() && al.IsMateMapped() && al.MateRefID == al.RefID && al.MatePosition < fragmentStart) fragmentStart = al.MatePosition;
+		key << 'U' << umi << ':' << fragmentStart;
+	}
+	else key << al.Position << (al.IsReverseStrand() ? '-' : '+') << al.MateRefID << ':' << al.MatePosition;
+	return key.str();
+}
+
+//collapse the reads of a locus to one per family, building its allele histogram & sequences
+void collapseFamilies(LOCUS_READS &reads){
+	vector<STRING_GT> &toPrint = reads.toPrint;
+	map<string, vector<size_t> > families;
+	for (size_t i = 0; i < toPrint.size(); ++i) families[toPrint[i].family].push_back(i);
+
+	vector<size_t> kept;
+	kept.reserve(families.size());
+	for (map<string, vector<size_t> >::iterator it = families.begin(); it != families.end(); ++it) {
+		vector<size_t> &members = it->second;
+		map<int,int> votes;
+		int most = 0;
+		for (vector<size_t>::iterator jt = members.begin(); jt < members.end(); ++jt) most = max(most, ++votes[toPrint[*jt].GT]);
+		vector<size_t>::iterator jt = members.begin();
+		while (votes[toPrint[*jt].GT] != most) ++jt;
+		kept.push_back(*jt);
+	}
+	sort(kept.begin(), kept.end());         //reads stay in the order they were read
+
+	vector<STRING_GT> consensus;
+	consensus.reserve(kept.size());
+	reads.alleles.clear();
+	reads.sequences = ALLELE_TABLE();
+	for (vector<size_t>::iterator it = kept.begin(); it < kept.end(); ++it) {
+		consensus.push_back(toPrint[*it]);
+		const STRING_GT &read = toPrint[*it];
+		reads.sequences.add(read.realigned.empty() ? alleleSequence(read.reads.alignedSeq, read.reads.postSeq) : read.realigned);
+		tallyAllele(reads.alleles, toPrint[*it]);
+	}
+	toPrint.swap(consensus);
+}
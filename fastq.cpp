@@ -0,0 +1,348 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// FASTQ module: genotyping straight from unaligned reads ("repeatseq fastq")
+//
+// The last -k bases of the left flank & the first -k bases of the right flank of each locus (the
+// leftReference & rightReference initLocus() fetches) are its anchors.  They are packed 2 bits a
+// base into a sorted table; k-mers that anchor more than one locus, or both sides of one, are
+// dropped.  Each read, & its reverse complement, is looked up k-mer by k-mer: a read holding the
+// left anchor of a locus followed by its right anchor spans the locus, & the bases between the
+// two anchors are its allele length (the last left anchor before the first right anchor is taken,
+// so a flank extending into the repeat can shorten it).  The alleles are counted per locus as
+// addRead() counts them & genotyped by printGenoPerc() as print_output() does; the calls are
+// written to <in.fastq>.calls in the format of the .calls file.
+//
+// Threads take chunks of FASTQ_CHUNK reads in turn from the (plain or gzipped) FASTQ file, each
+// counting into its own histograms, which are summed once the file is read.  Lines may be of any
+// length; a record whose name line doesn't start with '@' or whose third line doesn't start with
+// '+' (or that the file ends in the middle of) stops the run with an error.
+
+#include "repeatseq.h"
+#include <algorithm>
+#include <unistd.h>
+#include <zlib.h>
+
+#define FASTQ_CHUNK 4096
+#define FASTQ_LINE 65536                // bytes read from the FASTQ file at a time
+
+//an anchor k-mer, & the locus & side it anchors:
+struct ANCHOR {
+	uint64_t kmer;
+	uint32_t locus;
+	bool right;
+
+	bool operator<(const ANCHOR &other) const { return kmer < other.kmer; }
+};
+
+//the FASTQ file the threads share:
+struct FASTQ_INPUT {
+	gzFile file;
+	size_t records;                         // records read so far
+	size_t malformed;                       // number of the first malformed record (0 = none)
+};
+
+typedef struct {
+	FASTQ_INPUT * fastq;
+	pthread_mutex_t * lock;                 // held while a chunk is read from the FASTQ file
+	const vector<ANCHOR> * anchors;
+	size_t loci;
+	int k;
+	vector<vector<GT> > alleles;            // allele histogram of each locus
+	long reads, spanning;
+	pthread_t thread;
+} fastq_data_t;
+
+//pack a k-mer 2 bits a base; false if it holds a base other than ACGT
+bool packKmer(const char *bases, int k, uint64_t &kmer){
+	kmer = 0;
+	for (int i = 0; i < k; ++i) {
+		uint64_t code;
+		switch (bases[i]) {
+			case 'A': code = 0; break;
+			case 'C': code = 1; break;
+			case 'G': code = 2; break;
+			case 'T': code = 3; break;
+			default: return false;
+		}
+		kmer = (kmer << 2) | code;
+	}
+	return true;
+}
+
+string reverseComplement(const string &bases){
+	string rc(bases.rbegin(), bases.rend());
+	for (string::iterator c = rc.begin(); c < rc.end(); ++c) {
+		switch (*c) {
+			case 'A': *c = 'T'; break;
+			case 'C': *c = 'G'; break;
+			case 'G': *c = 'C'; break;
+			case 'T': *c = 'A'; break;
+			default: *c = 'N';
+		}
+	}
+	return rc;
+}
+
+//the anchors of the loci, sorted, without k-mers shared by two anchors
+vector<ANCHOR> buildAnchors(const vector<LOCUS> &loci, int k){
+	vector<ANCHOR> anchors;
+	anchors.reserve(2 * loci.size());
+	for (size_t i = 0; i < loci.size(); ++i) {
+		const LOCUS &locus = loci[i];
+		ANCHOR left, right;
+		if (int(locus.leftReference.length()) < k || int(locus.rightReference.length()) < k) continue;
+		if (!packKmer(locus.leftReference.data() + locus.leftReference.length() - k, k, left.kmer)) continue;
+		if (!packKmer(locus.rightReference.data(), k, right.kmer)) continue;
+		left.locus = right.locus = i;
+		left.right = false;
+		right.right = true;
+		anchors.push_back(left);
+		anchors.push_back(right);
+	}
+	sort(anchors.begin(), anchors.end());
+
+	vector<ANCHOR> unique;
+	unique.reserve(anchors.size());
+	for (size_t i = 0, j; i < anchors.size(); i = j) {
+		for (j = i + 1; j < anchors.size() && anchors[j].kmer == anchors[i].kmer; ++j);
+		if (j == i + 1) unique.push_back(anchors[i]);
+	}
+	return unique;
+}
+
+//count the allele of every locus a read (one strand of it) spans
+bool anchorRead(const string &bases, double avgBQ, bool reverse, fastq_data_t &data){
+	const vector<ANCHOR> &anchors = *data.anchors;
+	int k = data.k;
+	map<uint32_t, pair<int,int> > hits;     //locus -> last left anchor end, first right anchor start
+	uint64_t mask = (k == 32) ? ~uint64_t(0) : (uint64_t(1) << (2 * k)) - 1, kmer = 0;
+	int valid = 0;          //bases of the current k-mer that are ACGT
+	for (int i = 0; i < int(bases.length()); ++i) {
+		uint64_t code;
+		switch (bases[i]) {
+			case 'A': code = 0; break;
+			case 'C': code = 1; break;
+			case 'G': code = 2; break;
+			case 'T': code = 3; break;
+			default: valid = 0; continue;
+		}
+		kmer = ((kmer << 2) | code) & mask;
+		if (++valid < k) continue;
+
+		ANCHOR key;
+		key.kmer = kmer;
+		vector<ANCHOR>::const_iterator it = lower_bound(anchors.begin(), anchors.end(), key);
+		if (it == anchors.end() || it->kmer != kmer) continue;
+		map<uint32_t, pair<int,int> >::iterator hit = hits.insert(make_pair(it->locus, make_pair(-1, -1))).first;
+		if (!it->right && hit->second.second < 0) hit->second.first = i + 1;
+		else if (it->right && hit->second.second < 0 && hit->second.first >= 0) hit->second.second = i + 1 - k;
+	}
+
+	bool spanned = false;
+	for (map<uint32_t, pair<int,int> >::iterator hit = hits.begin(); hit != hits.end(); ++hit) {
+		if (hit->second.first < 0 || hit->second.second < hit->second.first) continue;
+		int length = hit->second.second - hit->second.first;
+		vector<GT> &alleles = data.alleles[hit->first];
+		vector<GT>::iterator it = alleles.begin();
+		while (it < alleles.end() && it->readlength != length) ++it;
+		if (it == alleles.end()) alleles.push_back(GT(length, 1, reverse, k, avgBQ));
+		else {
+			it->occurrences += 1;
+			it->avgBQ += avgBQ;
+			it->avgMinFlank += k;
+			if (reverse) it->reverse += 1;
+		}
+		spanned = true;
+	}
+	return spanned;
+}
+
+//read a line of any length, without its line break; false at the end of the file
+bool readLine(gzFile fastq, string &line){
+	char buffer[FASTQ_LINE];
+	line.clear();
+	while (gzgets(fastq, buffer, FASTQ_LINE)) {
+		line += buffer;
+		if (line[line.length()-1] == '\n') break;
+	}
+	if (line.empty()) return false;
+	line.erase(line.find_last_not_of("\r\n") + 1);
+	return true;
+}
+
+//read up to FASTQ_CHUNK records; false at the end of the file or once a record is malformed
+bool readChunk(FASTQ_INPUT &fastq, vector<string> &bases, vector<string> &qualities){
+	string name, plus;
+	bases.clear();
+	qualities.clear();
+	while (bases.size() < FASTQ_CHUNK && !fastq.malformed) {
+		bool named;
+		while ((named = readLine(fastq.file, name)) && name.empty());  //blank lines between records
+		if (!named) break;
+		bases.resize(bases.size() + 1);
+		qualities.resize(qualities.size() + 1);
+		++fastq.records;
+		if (name[0] != '@' || !readLine(fastq.file, bases.back()) || !readLine(fastq.file, plus) || plus.empty() || plus[0] != '+'
+			|| !readLine(fastq.file, qualities.back())) fastq.malformed = fastq.records;
+	}
+	if (fastq.malformed) {
+		bases.clear();
+		qualities.clear();
+	}
+	return !bases.empty();
+}
+
+void * fastq_thread(void * pdata){
+	fastq_data_t & data = *((fastq_data_t *) pdata);
+	vector<string> bases, qualities;
+	data.alleles.resize(data.loci);
+	for (;;) {
+		pthread_mutex_lock(data.lock);
+		bool more = readChunk(*data.fastq, bases, qualities);
+		pthread_mutex_unlock(data.lock);
+		if (!more) break;
+		for (size_t i = 0; i < bases.size(); ++i) {
+			upperCase(bases[i]);
+			double avgBQ = 0;
+			for (string::iterator q = qualities[i].begin(); q < qualities[i].end(); ++q) avgBQ += PhredToFloat(*q);
+			if (!qualities[i].empty()) avgBQ /= qualities[i].length();
+			bool spanned = anchorRead(bases[i], avgBQ, false, data);
+			if (anchorRead(reverseComplement(bases[i]), avgBQ, true, data)) spanned = true;
+			++data.reads;
+			if (spanned) ++data.spanning;
+		}
+	}
+	return NULL;
+}
+
+//the .calls line of a locus from its allele histogram, called as print_output() calls it
+string callFastqLocus(const LOCUS &locus, vector<GT> vectorGT, const SETTINGS_FILTERS &settings){
+	stringstream calls;
+	calls << locus.region << '\t' << locus.secondColumn << '\t';
+	int numReads = 0, totalOccurrences = 0, occurMajGT = 0, majGT = 0;
+	for (vector<GT>::iterator it = vectorGT.begin(); it < vectorGT.end(); ++it) {
+		numReads += it->occurrences;
+		it->avgBQ /= it->occurrences;
+		it->avgMinFlank /= it->occurrences;
+	}
+	sort(vectorGT.begin(), vectorGT.end(), vectorGTsort);
+	double concordance = -1;
+	if (vectorGT.size() == 1 && numReads > 1) {
+		concordance = 1;
+		majGT = vectorGT.front().readlength;
+	}
+	else if (vectorGT.size() > 1) {
+		for (vector<GT>::iterator it = vectorGT.begin(); it < vectorGT.end(); ++it) {
+			if (it->occurrences >= occurMajGT) {
+				occurMajGT = it->occurrences;
+				if (it->readlength > majGT) majGT = it->readlength;
+			}
+			totalOccurrences += it->occurrences;
+		}
+		concordance = double(occurMajGT - 1) / double(totalOccurrences - 1);
+	}
+
+	if (vectorGT.empty() || vectorGT[0].occurrences >= 10000 || (vectorGT.size() > 9 && settings.mode <= 2)) calls << "NA\tNA\n";
+	else if (concordance >= 0.99) calls << majGT << "\t50\n";
+	else {
+		double conf = 0;
+		map<pair<int,int>,double> likelihoods;
+		vector<int> vGT = printGenoPerc(vectorGT, locus.target.length(), locus.unitLength, conf, settings.mode, likelihoods);
+		if (numReads <= 1) conf = 0;
+		if (vGT.size() == 1 && conf > 3.02) calls << vGT[0] << '\t' << conf << '\n';
+		else if (vGT.size() >= 2 && conf > 3.02) calls << formatGenotype(vGT) << '\t' << conf << '\n';
+		else calls << "NA\tNA\n";
+	}
+	return calls.str();
+}
+
+//repeatseq fastq [options] <in.fastq[.gz]> <in.fasta> <in.regions>: genotype without alignment
+int scanFastq(int argc, char* argv[]){
+	try {
+		SETTINGS_FILTERS settings;
+		string fastq_file, fasta_file, position_file;
+		initLogFactorial();
+		parseSettings(argv + 1, argc - 1, settings, fastq_file, fasta_file, position_file);
+		if (settings.anchorK < 1 || settings.anchorK > 32) throw "-k must be from 1 to 32.";
+		if (settings.LR_CHARS_TO_PRINT < settings.anchorK) settings.LR_CHARS_TO_PRINT = settings.anchorK;
+
+		if (!fileCheck(fasta_file + ".fai")) {
+			cout << "Fasta index file not found, creating...";
+			buildFastaIndex(fasta_file);
+		}
+		FastaReference fr;
+		fr.open(fasta_file);
+
+		//the loci & their anchors:
+		ifstream range_file(position_file.c_str());
+		if (!range_file.is_open()) throw "Unable to open input range file.";
+		vector<LOCUS> loci;
+		string region;
+		while (getline(range_file, region)) {
+			LOCUS locus;
+			if (!initLocus(region, &fr, settings, locus)) continue;
+			locus.line = loci.size();
+			loci.push_back(locus);
+		}
+		vector<ANCHOR> anchors = buildAnchors(loci, settings.anchorK);
+
+		FASTQ_INPUT fastq;
+		fastq.file = gzopen(fastq_file.c_str(), "rb");
+		if (!fastq.file) throw "Unable to open FASTQ file.";
+		fastq.records = fastq.malformed = 0;
+		pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+		long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		vector<fastq_data_t> threads(num_threads < 1 ? 1 : num_threads);
+		for (size_t thread = 0; thread < threads.size(); ++thread) {
+			fastq_data_t &data = threads[thread];
+			data.fastq = &fastq;
+			data.lock = &lock;
+			data.anchors = &anchors;
+			data.loci = loci.size();
+			data.k = settings.anchorK;
+			data.reads = data.spanning = 0;
+			if (0 != pthread_create(&data.thread, NULL, fastq_thread, &data)) throw "Error creating FASTQ thread.";
+		}
+		for (size_t thread = 0; thread < threads.size(); ++thread)
+			if (0 != pthread_join(threads[thread].thread, NULL)) perror("Error closing FASTQ thread");
+		gzclose(fastq.file);
+		if (fastq.malformed) {
+			cerr << "Malformed FASTQ record " << fastq.malformed << " in " << fastq_file << endl;
+			throw "Unable to read FASTQ file.";
+		}
+
+		//sum the histograms of the threads & call the loci:
+		fastq_data_t &total = threads[0];
+		for (size_t thread = 1; thread < threads.size(); ++thread) {
+			total.reads += threads[thread].reads;
+			total.spanning += threads[thread].spanning;
+			for (size_t i = 0; i < loci.size(); ++i) {
+				vector<GT> &alleles = threads[thread].alleles[i];
+				for (vector<GT>::iterator it = alleles.begin(); it < alleles.end(); ++it) {
+					vector<GT>::iterator jt = total.alleles[i].begin();
+					while (jt < total.alleles[i].end() && jt->readlength != it->readlength) ++jt;
+					if (jt == total.alleles[i].end()) total.alleles[i].push_back(*it);
+					else {
+						jt->occurrences += it->occurrences;
+						jt->reverse += it->reverse;
+						jt->avgMinFlank += it->avgMinFlank;
+						jt->avgBQ += it->avgBQ;
+					}
+				}
+			}
+		}
+		string calls_filename = setToCD(fastq_file + settings.paramString + ".calls");
+		ofstream callsFile(calls_filename.c_str());
+		for (size_t i = 0; i < loci.size(); ++i) callsFile << callFastqLocus(loci[i], total.alleles[i], settings);
+		callsFile.close();
+		cerr << total.reads << " reads, " << total.spanning << " spanning a locus; " << anchors.size() << " anchors of " << loci.size() << " loci; calls in " << calls_filename << endl;
+	}
+	catch(const char* exOutput) {
+		cout << endl << exOutput << endl;
+		printArguments();
+		return 0;
+	}
+	return 0;
+}
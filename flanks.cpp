@@ -0,0 +1,113 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Flanks module: anchoring reads on their flanks with up to K errors (-flankerrors K)
+//
+// addRead() keeps a read only if -L bases before the repeat & -R after it match the reference
+// consecutively, so one sequencing error next to the repeat loses the read.  With -flankerrors K,
+// a read failing that test is kept if the edit distance between its flank & the reference's is at
+// most K.  The flanks compared are longer than the -o bases printed: initLocus() fetches the
+// -flankwindow bases (at most FLANK_WORD) of the reference on either side of the repeat, &
+// readFlank() takes the read's bases over those positions from its parsed CIGAR (inserted bases
+// included, deleted ones dropped).  A read must span at least -L (or -R) of them; the reference
+// flank is cut to the part the read spans.  Both are read outward from the repeat & aligned
+// globally, the read bases past the end of the reference flank being free (an insertion pushes
+// them beyond it).  The distance is computed with Myers' bit-parallel algorithm (Myers, 1999;
+// anchored as in Hyyro, 2001): the reference flank is the pattern, a bit of a 64-bit word per
+// base, & each read base takes a handful of word operations.  Soft-clipped bases ('S') match
+// nothing.
+
+#include "repeatseq.h"
+#include <algorithm>
+#include <limits.h>
+
+//code of a base in the match masks (5: matches nothing)
+inline int flankCode(char c){
+	switch (c) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+		case 'N': return 4;
+	}
+	return 5;
+}
+
+//edit distance between a pattern of at most FLANK_WORD bases & the best prefix of a text
+int myersDistance(const string &pattern, const string &text){
+	int m = pattern.length();
+	if (!m) return 0;
+	uint64_t Peq[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < m; ++i) Peq[flankCode(pattern[i])] |= uint64_t(1) << i;
+	Peq[5] = 0;
+	
+	uint64_t Pv = ~uint64_t(0), Mv = 0, high = uint64_t(1) << (m - 1);
+	int score = m, best = m;
+	for (string::const_iterator c = text.begin(); c < text.end(); ++c) {
+		uint64_t Eq = Peq[flankCode(*c)];
+		uint64_t Xv = Eq | Mv;
+		uint64_t Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+		uint64_t Ph = Mv | ~(Xh | Pv);
+		uint64_t Mh = Pv & Xh;
+		if (Ph & high) ++score;
+		else if (Mh & high) --score;
+		if (score < best) best = score;
+		Ph = (Ph << 1) | 1;         //the text is anchored at its first base: skipping bases before it costs one each
+		Mh <<= 1;
+		Pv = Mh | ~(Xv | Ph);
+		Mv = Ph & Xv;
+	}
+	return best;
+}
+
+//the read's bases over the reference positions from to to (1-based, inclusive) as read: inserted
+//bases between them included, deletions dropped; covered is how many of the positions it spans
+string readFlank(const PROJECTION &proj, int from, int to, int &covered){
+	string bases;
+	covered = 0;
+	int first = max(0, from - proj.alignStart + proj.clipShift);
+	int last = min(int(proj.steps.size()) - 1, to - proj.alignStart + proj.clipShift);
+	if (!proj.valid || first > last) return bases;
+	covered = last - first + 1;
+	
+	//the insertions between the positions are those with more than first steps ahead of them
+	vector<pair<int,string> >::const_iterator insertion = proj.insertions.begin();
+	while (insertion < proj.insertions.end() && insertion->first <= first) ++insertion;
+	
+	const string &expanded = proj.expanded;
+	bases.reserve(proj.steps[last] - proj.steps[first] + 1);
+	for (int i = proj.steps[first]; i <= proj.steps[last]; ++i) {
+		char c = expanded[i];
+		if (c == '-') continue;
+		if (c == 'd' && insertion < proj.insertions.end()) {
+			for (string::const_iterator b = insertion->second.begin(); b < insertion->second.end(); ++b) bases += *b - 1;
+			i += insertion->second.length() - 1;
+			++insertion;
+		}
+		else if (c >= 'a' && c <= 'z') bases += c - 32;     //base ahead of an insertion
+		else bases += c;
+	}
+	return bases;
+}
+
+//edit distance between the read's flank before (left) or after the repeat & the reference's, both
+//read outward from the repeat; INT_MAX if the read spans fewer than need of the flank's bases
+int flankDistance(const PROJECTION &proj, const LOCUS &locus, bool left, int need){
+	const Region &target = locus.target;
+	const string &flank = left ? locus.leftFlank : locus.rightFlank;
+	int covered;
+	string bases, pattern;
+	if (left) {
+		bases = readFlank(proj, target.startPos - int(flank.length()), target.startPos - 1, covered);
+		pattern = flank.substr(flank.length() - covered);
+		reverse(bases.begin(), bases.end());
+		reverse(pattern.begin(), pattern.end());
+	}
+	else {
+		bases = readFlank(proj, target.stopPos + 1, target.stopPos + int(flank.length()), covered);
+		pattern = flank.substr(0, covered);
+	}
+	if (covered < min(need, int(flank.length()))) return INT_MAX;
+	return myersDistance(pattern, bases);
+}
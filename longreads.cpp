@@ -0,0 +1,75 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Long-reads module: walking only the part of a 10-100kb read around each locus (-longreads)
+//
+// parseCigar() lines a whole read up against the reference, & projectLocus() copies everything
+// from the locus to the end of the read, so a read spanning many loci costs its length at each
+// of them.  With -longreads, dispatchRead() instead indexes the CIGAR of a read once: the
+// reference & read positions at which each operation starts.  For each locus the read overlaps,
+// windowCigar() finds by binary search the operation holding the start of the locus' window
+// (LR_CHARS_TO_PRINT & LONG_READ_PAD bases to either side of the repeat), & walks only the
+// operations of the window, cut to it.  Reads are also fetched once for every locus they span,
+// as -longreads lets loci up to LONG_READ_SIZE bases apart be read as one run.
+
+#include "repeatseq.h"
+#include <algorithm>
+
+inline bool consumesReference(char type) { return (type == 'M' || type == 'D' || type == 'N' || type == '=' || type == 'X'); }
+inline bool consumesQuery(char type) { return (type == 'M' || type == 'I' || type == 'S' || type == '=' || type == 'X'); }
+
+//index the CIGAR of a read (& the per-read fields parseCigar() would set)
+void indexCigar(const BamAlignment &al, PROJECTION &proj){
+	const vector<CigarOp> &cigar = al.CigarData;
+	proj.opRef.resize(cigar.size());
+	proj.opQuery.resize(cigar.size());
+	proj.readSize = 0;
+	proj.valid = true;
+	
+	int ref = al.Position, query = 0;
+	for (size_t k = 0; k < cigar.size(); ++k) {
+		proj.opRef[k] = ref;
+		proj.opQuery[k] = query;
+		if (cigar[k].Type == 'N') proj.valid = false;
+		if (consumesReference(cigar[k].Type)) ref += cigar[k].Length;
+		if (consumesQuery(cigar[k].Type)) query += cigar[k].Length;
+	}
+	proj.alignEnd = ref;
+	proj.readSize = query;
+	
+	//determine average base quality:
+	proj.avgBQ = 0;
+	for (int i=0; i<al.Qualities.length(); ++i){ proj.avgBQ += PhredToFloat(al.Qualities[i]); }
+	proj.avgBQ /= al.Qualities.length();
+}
+
+//walk the operations of an indexed read covering the reference from refFrom to refTo (0-based, refTo exclusive)
+void windowCigar(const BamAlignment &al, PROJECTION &proj, int refFrom, int refTo){
+	const vector<CigarOp> &cigar = al.CigarData;
+	vector<CigarOp> &window = proj.window;
+	window.clear();
+	if (!proj.valid) return;
+	
+	//a window holding the start of the read is walked from its first operation (with any soft clip):
+	size_t k = 0;
+	int skip = 0;
+	if (refFrom > al.Position) {
+		k = upper_bound(proj.opRef.begin(), proj.opRef.end(), refFrom) - proj.opRef.begin() - 1;
+		if (consumesReference(cigar[k].Type)) skip = refFrom - proj.opRef[k];
+	}
+	proj.alignStart = max(refFrom, al.Position) + 1;
+	proj.clipShift = (k == 0 && cigar[0].Type == 'S') ? cigar[0].Length : 0;
+	proj.queryStart = proj.opQuery[k] + (consumesQuery(cigar[k].Type) ? skip : 0);
+	
+	for (; k < cigar.size() && proj.opRef[k] < refTo; ++k) {
+		CigarOp op = cigar[k];
+		int length = op.Length;
+		if (consumesReference(op.Type)) length = min(proj.opRef[k] + length, refTo) - proj.opRef[k] - skip;
+		skip = 0;
+		if (length <= 0) continue;
+		op.Length = length;
+		window.push_back(op);
+	}
+	walkCigar(window.begin(), window.end(), al.QueryBases, proj.queryStart, proj);
+}
@@ -0,0 +1,267 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Output index module: sidecar indexes of the .repeatseq & .calls files, & the view subcommand
+//
+// print_output() notes where each locus' record starts & ends in its worker's output; once main()
+// has consolidated the output, the offsets of the records in the .repeatseq & .calls files are
+// written to <file>.rsi.  The records of the index are sorted by chromosome & start so that
+// "repeatseq view <file> chr:start-end" finds them with a binary search, seeking in the index
+// rather than loading it, & then seeks straight to the records in the file.  A second table holds
+// the numbers of the records in order of their line in the region file, so that "repeatseq view
+// <file> line" (counting from 1) finds a locus with a binary search too.
+//
+// Index layout (integers little-endian):
+//   "RSQI" uint32 version, uint32 chromosomes, for each: uint32 length & name
+//   int32 longest locus (stop - start), uint64 records
+//   records of OUTPUT_RECORD_SIZE bytes: uint32 line, uint32 chromosome, int32 start, int32 stop,
+//   uint64 offset, uint64 length
+//   uint64 number of each record, in order of line
+// The outputs are plain text, so offsets are byte offsets.
+
+#include "repeatseq.h"
+#include <algorithm>
+#include <string.h>
+#include <limits.h>
+
+#define OUTPUT_INDEX_MAGIC "RSQI"
+#define OUTPUT_INDEX_VERSION 2
+#define OUTPUT_RECORD_SIZE 32
+
+//a locus in an index, with the offset of its record in the indexed file:
+struct INDEX_RECORD {
+	uint32_t line, chr;
+	int32_t start, stop;
+	uint64_t offset, length;
+
+	bool operator<(const INDEX_RECORD &other) const {
+		if (chr != other.chr) return chr < other.chr;
+		if (start != other.start) return start < other.start;
+		return line < other.line;
+	}
+};
+
+//orders the numbers of sorted records by the records' lines
+struct RECORD_LINE_ORDER {
+	const vector<INDEX_RECORD> &records;
+	RECORD_LINE_ORDER(const vector<INDEX_RECORD> &records) : records(records) {}
+	bool operator()(uint64_t a, uint64_t b) const { return records[a].line < records[b].line; }
+};
+
+template <typename T>
+inline void putValue(string &out, T value){
+	for (size_t i = 0; i < sizeof(T); ++i) out += char((uint64_t(value) >> (8 * i)) & 0xff);
+}
+
+template <typename T>
+inline T getValue(const char *in){
+	uint64_t value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i) value |= uint64_t((unsigned char) in[i]) << (8 * i);
+	return T(value);
+}
+
+//write the index of the .repeatseq file (calls = false) or of the .calls file
+bool writeOutputIndex(string filename, const vector<worker_data_t *> &workers, bool calls){
+	vector<string> chromosomes;
+	map<string,uint32_t> chrIndex;
+	vector<INDEX_RECORD> records;
+	int32_t longest = 0;
+	uint64_t base = 0;      //offset of the worker's output in the file
+
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		worker_data_t &worker = *workers[thread];
+		for (vector<OUTPUT_RECORD>::const_iterator it = worker.outputIndex.begin(); it < worker.outputIndex.end(); ++it) {
+			map<string,uint32_t>::iterator chr = chrIndex.find(it->chr);
+			if (chr == chrIndex.end()) {
+				chr = chrIndex.insert(make_pair(it->chr, uint32_t(chromosomes.size()))).first;
+				chromosomes.push_back(it->chr);
+			}
+			INDEX_RECORD record;
+			record.line = it->line;
+			record.chr = chr->second;
+			record.start = it->start;
+			record.stop = it->stop;
+			record.offset = base + (calls ? it->callsStart : it->repeatseqStart);
+			record.length = calls ? it->callsEnd - it->callsStart : it->repeatseqEnd - it->repeatseqStart;
+			longest = max(longest, record.stop - record.start);
+			records.push_back(record);
+		}
+		stringstream &output = calls ? worker.callsFile : worker.oFile;
+		base += max(streamoff(output.tellp()), streamoff(0));
+	}
+	sort(records.begin(), records.end());
+
+	string header(OUTPUT_INDEX_MAGIC);
+	putValue(header, uint32_t(OUTPUT_INDEX_VERSION));
+	putValue(header, uint32_t(chromosomes.size()));
+	for (vector<string>::iterator it = chromosomes.begin(); it < chromosomes.end(); ++it) {
+		putValue(header, uint32_t(it->length()));
+		header += *it;
+	}
+	putValue(header, longest);
+	putValue(header, uint64_t(records.size()));
+
+	ofstream out(filename.c_str(), ios::out | ios::binary);
+	if (!out.is_open()) return false;
+	out << header;
+	string record;
+	for (vector<INDEX_RECORD>::iterator it = records.begin(); it < records.end(); ++it) {
+		record.clear();
+		putValue(record, it->line);
+		putValue(record, it->chr);
+		putValue(record, it->start);
+		putValue(record, it->stop);
+		putValue(record, it->offset);
+		putValue(record, it->length);
+		out << record;
+	}
+	vector<uint64_t> byLine(records.size());
+	for (size_t r = 0; r < byLine.size(); ++r) byLine[r] = r;
+	stable_sort(byLine.begin(), byLine.end(), RECORD_LINE_ORDER(records));
+	for (vector<uint64_t>::iterator it = byLine.begin(); it < byLine.end(); ++it) {
+		record.clear();
+		putValue(record, *it);
+		out << record;
+	}
+	out.close();
+	return !out.fail();
+}
+
+//an index opened for lookups; records are read from the file as they are needed
+class OutputIndex {
+public:
+	vector<string> chromosomes;
+	int32_t longest;
+	uint64_t records;
+
+	bool open(string filename){
+		in.open(filename.c_str(), ios::in | ios::binary);
+		char buffer[8];
+		if (!in.read(buffer, 8) || memcmp(buffer, OUTPUT_INDEX_MAGIC, 4) != 0) return false;
+		if (getValue<uint32_t>(buffer + 4) != OUTPUT_INDEX_VERSION) return false;
+		if (!in.read(buffer, 4)) return false;
+		uint32_t numChr = getValue<uint32_t>(buffer);
+		for (uint32_t chr = 0; chr < numChr; ++chr) {
+			if (!in.read(buffer, 4)) return false;
+			string name(getValue<uint32_t>(buffer), '\0');
+			if (!name.empty() && !in.read(&name[0], name.length())) return false;
+			chromosomes.push_back(name);
+		}
+		if (!in.read(buffer, 4)) return false;
+		longest = getValue<int32_t>(buffer);
+		if (!in.read(buffer, 8)) return false;
+		records = getValue<uint64_t>(buffer);
+		first = in.tellg();
+		return true;
+	}
+
+	bool read(uint64_t index, INDEX_RECORD &record){
+		char buffer[OUTPUT_RECORD_SIZE];
+		in.clear();
+		in.seekg(first + streamoff(index * OUTPUT_RECORD_SIZE));
+		if (!in.read(buffer, OUTPUT_RECORD_SIZE)) return false;
+		record.line = getValue<uint32_t>(buffer);
+		record.chr = getValue<uint32_t>(buffer + 4);
+		record.start = getValue<int32_t>(buffer + 8);
+		record.stop = getValue<int32_t>(buffer + 12);
+		record.offset = getValue<uint64_t>(buffer + 16);
+		record.length = getValue<uint64_t>(buffer + 24);
+		return true;
+	}
+
+	//the first record at or after (chr, start)
+	uint64_t lowerBound(uint32_t chr, int32_t start){
+		uint64_t low = 0, high = records;
+		INDEX_RECORD record;
+		while (low < high) {
+			uint64_t middle = low + (high - low) / 2;
+			if (!read(middle, record)) return records;
+			if (record.chr < chr || (record.chr == chr && record.start < start)) low = middle + 1;
+			else high = middle;
+		}
+		return low;
+	}
+
+	//the number of the record at position index of the line table
+	bool readLine(uint64_t index, uint64_t &number){
+		char buffer[8];
+		in.clear();
+		in.seekg(first + streamoff(records * OUTPUT_RECORD_SIZE + index * 8));
+		if (!in.read(buffer, 8)) return false;
+		number = getValue<uint64_t>(buffer);
+		return true;
+	}
+
+	//the position in the line table of the first record at or after line
+	uint64_t lineBound(uint32_t line){
+		uint64_t low = 0, high = records, number;
+		INDEX_RECORD record;
+		while (low < high) {
+			uint64_t middle = low + (high - low) / 2;
+			if (!readLine(middle, number) || !read(number, record)) return records;
+			if (record.line < line) low = middle + 1;
+			else high = middle;
+		}
+		return low;
+	}
+
+private:
+	ifstream in;
+	streamoff first;
+};
+
+//copy the record of a locus from the indexed file to stdout
+bool printRecord(ifstream &file, const INDEX_RECORD &record){
+	string text(record.length, '\0');
+	file.clear();
+	file.seekg(record.offset);
+	if (record.length && !file.read(&text[0], record.length)) return false;
+	cout << text;
+	return true;
+}
+
+//repeatseq view <in.repeatseq|in.calls> <chr:start-end | chr | line> ...: print the records of loci
+int viewOutput(int argc, char* argv[]){
+	if (argc < 4) {
+		cout << "Usage: repeatseq view <in.repeatseq|in.calls> <chr:start-end | chr | region file line> ..." << endl;
+		return 0;
+	}
+	string filename = argv[2];
+	ifstream file(filename.c_str(), ios::in | ios::binary);
+	OutputIndex index;
+	if (!file.is_open() || !index.open(filename + ".rsi")) {
+		cout << "Unable to open " << filename << " & its index " << filename << ".rsi" << endl;
+		return 0;
+	}
+
+	for (int i = 3; i < argc; ++i) {
+		string query = argv[i];
+		INDEX_RECORD record;
+
+		//a line of the region file (1-based, as the region file & .calls are; the index counts from 0):
+		if (query.find_first_not_of("0123456789") == string::npos) {
+			uint32_t line = strtoul(query.c_str(), NULL, 10);
+			uint64_t number;
+			if (line-- == 0) continue;
+			for (uint64_t r = index.lineBound(line); r < index.records && index.readLine(r, number) && index.read(number, record); ++r) {
+				if (record.line != line) break;
+				printRecord(file, record);
+			}
+			continue;
+		}
+
+		//the loci overlapping a region (1-based, as in the region file):
+		Region region(query);
+		vector<string>::iterator chr = find(index.chromosomes.begin(), index.chromosomes.end(), region.startSeq);
+		if (chr == index.chromosomes.end()) continue;
+		uint32_t chrID = chr - index.chromosomes.begin();
+		int32_t start = region.startPos < 0 ? 0 : region.startPos, stop = region.stopPos < 0 ? INT_MAX : region.stopPos;
+		for (uint64_t r = index.lowerBound(chrID, start - index.longest); r < index.records && index.read(r, record); ++r) {
+			if (record.chr != chrID || record.start > stop) break;
+			if (record.stop >= start) printRecord(file, record);
+		}
+	}
+	cout << flush;
+	return 0;
+}
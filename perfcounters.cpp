@@ -0,0 +1,155 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Hardware counter module: cycles, instructions, last-level cache misses & branch misses per stage
+//
+// Each thread opens the four counters as one perf_event group (counting its own user-space work
+// only), so a single read() gives all of them.  perfBegin() & perfEnd() bracket a stage; the
+// difference is added to the thread's totals for that stage, which are folded into the run's
+// totals when the thread ends.  Counters the kernel refuses (perf_event_paranoid, containers,
+// virtual machines without a PMU) are reported as NA; without any, the stages are only counted.
+// The same brackets tell the allocation profiler (allocprofile.cpp) which stage is running.
+
+#include "repeatseq.h"
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define PERF_COUNTERS 4
+
+const char * perfStageNames[PERF_STAGES + 1] = { "parseCigar", "addRead", "expand", "printGenoPerc", "getVCF", "print_output", "consolidate", "other" };
+const char * perfCounterNames[PERF_COUNTERS] = { "cycles", "instructions", "LLC misses", "branch misses" };
+
+struct PERF_TOTALS {
+	uint64_t calls[PERF_STAGES];
+	uint64_t counts[PERF_STAGES][PERF_COUNTERS];
+};
+
+struct PERF_THREAD {
+	int leader;                             // fd of the group (-1 if no counter could be opened)
+	int fds[PERF_COUNTERS];
+	int member[PERF_COUNTERS];              // position of each counter in a group read (-1 if not open)
+	int members;
+	PERF_TOTALS totals;
+};
+
+bool perfEnabled = false;
+bool perfAvailable[PERF_COUNTERS];          // the counter opened in at least one thread
+PERF_TOTALS perfTotals;
+pthread_mutex_t perfMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread PERF_THREAD * perfState = NULL;    // the counters of the calling thread
+
+void initPerf(const SETTINGS_FILTERS &settings){
+	perfEnabled = settings.perfCounters;
+	memset(&perfTotals, 0, sizeof(perfTotals));
+	for (int c = 0; c < PERF_COUNTERS; ++c) perfAvailable[c] = false;
+}
+
+#ifdef __linux__
+int openCounter(uint64_t config, int group){
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+//open the counters of the calling thread
+void perfThread(){
+	if (!perfEnabled) return;
+	perfState = new PERF_THREAD;
+	memset(&perfState->totals, 0, sizeof(perfState->totals));
+	perfState->leader = -1;
+	perfState->members = 0;
+
+#ifdef __linux__
+	const uint64_t configs[PERF_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		perfState->fds[c] = openCounter(configs[c], perfState->leader);
+		perfState->member[c] = -1;
+		if (perfState->fds[c] < 0) continue;
+		if (perfState->leader < 0) perfState->leader = perfState->fds[c];
+		perfState->member[c] = perfState->members++;
+	}
+#else
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		perfState->fds[c] = -1;
+		perfState->member[c] = -1;
+	}
+#endif
+}
+
+//close the counters of the calling thread, adding its counts to the run's
+void perfThreadDone(){
+	if (!perfState) return;
+	pthread_mutex_lock(&perfMutex);
+	for (int s = 0; s < PERF_STAGES; ++s) {
+		perfTotals.calls[s] += perfState->totals.calls[s];
+		for (int c = 0; c < PERF_COUNTERS; ++c) perfTotals.counts[s][c] += perfState->totals.counts[s][c];
+	}
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (perfState->member[c] >= 0) perfAvailable[c] = true;
+		if (perfState->fds[c] >= 0) close(perfState->fds[c]);
+	}
+	pthread_mutex_unlock(&perfMutex);
+	delete perfState;
+	perfState = NULL;
+}
+
+//read the counters of the calling thread into mark
+inline void readCounters(PERF_MARK &mark){
+	uint64_t values[1 + PERF_COUNTERS];
+	mark.valid = (perfState->leader >= 0 && read(perfState->leader, values, sizeof(values)) >= ssize_t((1 + perfState->members) * sizeof(uint64_t)));
+	if (!mark.valid) return;
+	for (int c = 0; c < PERF_COUNTERS; ++c) mark.values[c] = perfState->member[c] >= 0 ? values[1 + perfState->member[c]] : 0;
+}
+
+void perfBegin(int stage, PERF_MARK &mark){
+	mark.stage = stage;
+	mark.outer = allocEnter(stage);
+	if (perfState) readCounters(mark);
+}
+
+void perfEnd(const PERF_MARK &begin){
+	int stage = begin.stage;
+	allocLeave(begin.outer);
+	if (!perfState) return;
+	++perfState->totals.calls[stage];
+	if (!begin.valid) return;
+	PERF_MARK end;
+	readCounters(end);
+	if (!end.valid) return;
+	for (int c = 0; c < PERF_COUNTERS; ++c) perfState->totals.counts[stage][c] += end.values[c] - begin.values[c];
+}
+
+void printPerfStats(){
+	if (!perfEnabled) return;
+	stringstream table;
+	table << setiosflags(ios::fixed) << setprecision(2);
+	table << "stage\tcalls";
+	for (int c = 0; c < PERF_COUNTERS; ++c) table << '\t' << perfCounterNames[c] << "/call";
+	table << "\tIPC\n";
+	for (int s = 0; s < PERF_STAGES; ++s) {
+		uint64_t calls = perfTotals.calls[s];
+		if (!calls) continue;
+		table << perfStageNames[s] << '\t' << calls;
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			if (perfAvailable[c]) table << '\t' << double(perfTotals.counts[s][c]) / calls;
+			else table << "\tNA";
+		}
+		if (perfAvailable[0] && perfAvailable[1] && perfTotals.counts[s][0]) table << '\t' << double(perfTotals.counts[s][1]) / perfTotals.counts[s][0] << '\n';
+		else table << "\tNA\n";
+	}
+	if (!perfAvailable[0] && !perfAvailable[1] && !perfAvailable[2] && !perfAvailable[3])
+		table << "(hardware counters are not available here; see /proc/sys/kernel/perf_event_paranoid)\n";
+	cerr << table.str() << flush;
+}
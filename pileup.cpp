@@ -0,0 +1,306 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Pileup module: a compact binary form of the .repeatseq file
+//
+// print_output() hands each locus to the PILEUP_WRITER of its worker, which encodes it into a
+// block; once a block holds PILEUP_BLOCK_SIZE bytes it is deflated (zlib) by the worker, so the
+// blocks are compressed in parallel & main() only concatenates them.  A locus is:
+//   varint & bytes   its .repeatseq header line
+//   varint           its start position
+//   3 x (varint & bytes)   the pre, repeat & post strings of the reference row
+//   varint           reads, then for each read:
+//     3 x zigzag     length of its pre, repeat & post strings less those of the reference row
+//     4-bit codes    a code per base, two a byte: 0 for the base of the reference row at that place,
+//                    PILEUP_BASES for the others, 15 for a base given in full after the codes
+//     zigzag         start position less that of the locus; varints for the read length, the
+//                    matching flank bases left & right, 10000 x the average base quality & MapQ
+//     varint         flags (bit i set for the i-th letter of PILEUP_FLAGS)
+//     varint         CIGAR operations, then for each varint length << 4 | index in PILEUP_CIGAR
+//     varint         index of the read name in the block's dictionary; a name not yet in it is
+//                    followed by a varint of the bytes it shares with the last name added, a
+//                    varint length & the rest of the name
+// File: "RSQP", uint32 version, then blocks of uint32 compressed bytes, uint32 bytes & uint32 loci
+// (little-endian) followed by the deflated block; a block of 0 bytes ends the file.  Each block
+// has its own dictionary, so blocks can be read on their own.  "repeatseq pileup <in.pileup>"
+// prints the .repeatseq text the run would have written.
+
+#include "repeatseq.h"
+#include <string.h>
+#include <zlib.h>
+
+#define PILEUP_MAGIC "RSQP"
+#define PILEUP_VERSION 1
+#define PILEUP_BLOCK_SIZE (1 << 20)
+#define PILEUP_COMPRESSION 1        // zlib level: fast, the encoding does most of the work
+#define PILEUP_ESCAPE 15
+
+const char PILEUP_BASES[] = "\0ACGTN-xSXBUDHO";     // codes 1-14 (0 = same as the reference)
+const char PILEUP_FLAGS[] = "pPuUrR12sfd";
+const char PILEUP_CIGAR[] = "MIDNSHP=X";
+
+inline void putVarint(string &out, uint64_t value){
+	while (value >= 0x80) {
+		out += char((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += char(value);
+}
+
+inline void putSigned(string &out, int64_t value){
+	putVarint(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+inline void putString(string &out, const string &value){
+	putVarint(out, value.length());
+	out += value;
+}
+
+inline uint64_t getVarint(const string &in, size_t &pos){
+	uint64_t value = 0;
+	for (int shift = 0; pos < in.length(); shift += 7) {
+		unsigned char c = in[pos++];
+		value |= uint64_t(c & 0x7f) << shift;
+		if (!(c & 0x80)) break;
+	}
+	return value;
+}
+
+inline int64_t getSigned(const string &in, size_t &pos){
+	uint64_t value = getVarint(in, pos);
+	return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+inline string getString(const string &in, size_t &pos){
+	size_t length = getVarint(in, pos);
+	string value = in.substr(min(pos, in.length()), length);
+	pos += length;
+	return value;
+}
+
+inline void putUint32(string &out, uint32_t value){
+	for (int i = 0; i < 4; ++i) out += char((value >> (8 * i)) & 0xff);
+}
+
+inline uint32_t getUint32(const char *in){
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i) value |= uint32_t((unsigned char) in[i]) << (8 * i);
+	return value;
+}
+
+//the flags of a read as a bit mask of PILEUP_FLAGS
+int pileupFlags(const BamAlignment &al){
+	bool flags[] = { al.IsPaired(), al.IsProperPair(), !al.IsMapped(), !al.IsMateMapped(), al.IsReverseStrand(), al.IsMateReverseStrand(),
+	                 al.IsFirstMate(), al.IsSecondMate(), !al.IsPrimaryAlignment(), al.IsFailedQC(), al.IsDuplicate() };
+	int mask = 0;
+	for (int i = 0; i < int(sizeof(flags)); ++i) if (flags[i]) mask |= 1 << i;
+	return mask;
+}
+
+PILEUP_WRITER::PILEUP_WRITER(){
+	loci = 0;
+}
+
+//4-bit codes of a read's bases against the reference row, & those given in full
+void encodeBases(string &out, const string &bases, const string &reference){
+	string escaped;
+	int pending = -1;
+	for (size_t i = 0; i < bases.length(); ++i) {
+		int code;
+		if (i < reference.length() && bases[i] == reference[i]) code = 0;
+		else {
+			const char *found = bases[i] ? (const char*) memchr(PILEUP_BASES + 1, bases[i], sizeof(PILEUP_BASES) - 2) : NULL;
+			code = found ? found - PILEUP_BASES : PILEUP_ESCAPE;
+			if (code == PILEUP_ESCAPE) escaped += bases[i];
+		}
+		if (pending < 0) pending = code;
+		else {
+			out += char(pending | (code << 4));
+			pending = -1;
+		}
+	}
+	if (pending >= 0) out += char(pending);
+	out += escaped;
+}
+
+void PILEUP_WRITER::add(const LOCUS &locus, const string &header, const vector<STRING_GT> &toPrint){
+	putString(block, header);
+	putVarint(block, locus.target.startPos);
+	const Sequences &ref = toPrint[0].reads;
+	putString(block, ref.preSeq);
+	putString(block, ref.alignedSeq);
+	putString(block, ref.postSeq);
+
+	putVarint(block, toPrint.size() - 1);
+	for (vector<STRING_GT>::const_iterator it = toPrint.begin() + 1; it < toPrint.end(); ++it) {
+		const Sequences &read = it->reads;
+		const PILEUP_READ &fields = it->pileup;
+		putSigned(block, int64_t(read.preSeq.length()) - int64_t(ref.preSeq.length()));
+		putSigned(block, int64_t(read.alignedSeq.length()) - int64_t(ref.alignedSeq.length()));
+		putSigned(block, int64_t(read.postSeq.length()) - int64_t(ref.postSeq.length()));
+		//each part is compared to the same part of the reference row
+		string bases = read.preSeq + read.alignedSeq + read.postSeq, against;
+		against.reserve(bases.length());
+		against = ref.preSeq;
+		against.resize(read.preSeq.length(), '\0');
+		against += ref.alignedSeq;
+		against.resize(read.preSeq.length() + read.alignedSeq.length(), '\0');
+		against += ref.postSeq;
+		encodeBases(block, bases, against);
+
+		putSigned(block, int64_t(fields.position) - locus.target.startPos);
+		putVarint(block, fields.readSize);
+		putVarint(block, fields.flankLeft);
+		putVarint(block, fields.flankRight);
+		putVarint(block, fields.baseQuality);
+		putVarint(block, it->MapQ);
+		putVarint(block, fields.flags);
+		putVarint(block, fields.cigar.size());
+		for (vector<CigarOp>::const_iterator op = fields.cigar.begin(); op < fields.cigar.end(); ++op) {
+			const char *type = strchr(PILEUP_CIGAR, op->Type);
+			putVarint(block, (uint64_t(op->Length) << 4) | (type && op->Type ? type - PILEUP_CIGAR : 0));
+		}
+
+		map<string,size_t>::iterator name = names.find(fields.name);
+		if (name != names.end()) putVarint(block, name->second);
+		else {
+			putVarint(block, names.size());
+			size_t shared = 0;
+			while (shared < fields.name.length() && shared < lastName.length() && fields.name[shared] == lastName[shared]) ++shared;
+			putVarint(block, shared);
+			putString(block, fields.name.substr(shared));
+			names.insert(make_pair(fields.name, names.size()));
+			lastName = fields.name;
+		}
+	}
+
+	++loci;
+	if (block.length() >= PILEUP_BLOCK_SIZE) flush();
+}
+
+//deflate the block into the finished output
+void PILEUP_WRITER::flush(){
+	if (!loci) return;
+	uLongf bytes = compressBound(block.length());
+	string compressed(bytes, '\0');
+	if (compress2((Bytef*) &compressed[0], &bytes, (const Bytef*) block.data(), block.length(), PILEUP_COMPRESSION) != Z_OK)
+		throw "Could not compress pileup block.";
+	putUint32(output, bytes);
+	putUint32(output, block.length());
+	putUint32(output, loci);
+	output.append(compressed, 0, bytes);
+
+	block.clear();
+	names.clear();
+	lastName = "";
+	loci = 0;
+}
+
+//write the blocks of the workers, in order, to a pileup file
+bool writePileup(string filename, vector<worker_data_t *> &workers){
+	ofstream out(filename.c_str(), ios::out | ios::binary);
+	if (!out.is_open()) return false;
+	string header(PILEUP_MAGIC);
+	putUint32(header, PILEUP_VERSION);
+	out << header;
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		workers[thread]->pileup.flush();
+		out << workers[thread]->pileup.output;
+		workers[thread]->pileup.output.clear();
+	}
+	string end;
+	for (int i = 0; i < 3; ++i) putUint32(end, 0);
+	out << end;
+	out.close();
+	return !out.fail();
+}
+
+//print the .repeatseq text of a decompressed block
+void printPileupBlock(const string &block, uint32_t loci, ostream &out){
+	vector<string> names;
+	string lastName;
+	size_t pos = 0;
+	for (uint32_t locus = 0; locus < loci && pos < block.length(); ++locus) {
+		out << getString(block, pos) << '\n';
+		int64_t start = getVarint(block, pos);
+		string refPre = getString(block, pos), refAligned = getString(block, pos), refPost = getString(block, pos);
+		size_t reads = getVarint(block, pos);
+		if (reads) out << refPre << ' ' << refAligned << ' ' << refPost << '\n';
+
+		for (size_t r = 0; r < reads && pos < block.length(); ++r) {
+			size_t preLength = refPre.length() + getSigned(block, pos);
+			size_t alignedLength = refAligned.length() + getSigned(block, pos);
+			size_t postLength = refPost.length() + getSigned(block, pos);
+			string against = refPre;
+			against.resize(preLength, '\0');
+			against += refAligned;
+			against.resize(preLength + alignedLength, '\0');
+			against += refPost;
+
+			size_t length = preLength + alignedLength + postLength;
+			string bases(length, 'x');
+			size_t codes = pos;
+			pos += (length + 1) / 2;
+			for (size_t i = 0; i < length && codes + i / 2 < block.length(); ++i) {
+				int code = ((unsigned char) block[codes + i / 2] >> (4 * (i % 2))) & 0xf;
+				if (code == 0 && i < against.length()) bases[i] = against[i];
+				else if (code == PILEUP_ESCAPE && pos < block.length()) bases[i] = block[pos++];
+				else if (code && code != PILEUP_ESCAPE) bases[i] = PILEUP_BASES[code];
+			}
+			out << bases.substr(0, preLength) << ' ' << bases.substr(preLength, alignedLength) << ' ' << bases.substr(preLength + alignedLength);
+
+			//the fields as addRead() prints them:
+			int64_t position = start + getSigned(block, pos);
+			uint64_t readSize = getVarint(block, pos), flankLeft = getVarint(block, pos), flankRight = getVarint(block, pos);
+			int baseQuality = getVarint(block, pos), mapQ = getVarint(block, pos), flags = getVarint(block, pos);
+			out << ' ' << position << ' ' << readSize << ' ' << flankLeft << ' ' << flankRight << ' ';
+			out << "B:" << float(baseQuality)/10000 << ' ' << "M:" << mapQ << ' ' << "F:";
+			for (int i = 0; PILEUP_FLAGS[i]; ++i) if (flags & (1 << i)) out << PILEUP_FLAGS[i];
+			out << " C:";
+			for (size_t ops = getVarint(block, pos); ops > 0; --ops) {
+				uint64_t op = getVarint(block, pos);
+				out << (op >> 4) << PILEUP_CIGAR[min(op & 0xf, uint64_t(sizeof(PILEUP_CIGAR) - 2))];
+			}
+
+			size_t name = getVarint(block, pos);
+			if (name >= names.size()) {
+				size_t shared = getVarint(block, pos);
+				lastName = lastName.substr(0, shared) + getString(block, pos);
+				names.push_back(lastName);
+			}
+			out << " ID:" << names[min(name, names.size() - 1)] << '\n';
+		}
+	}
+}
+
+//repeatseq pileup <in.pileup>: print the .repeatseq text of a pileup file
+int printPileup(int argc, char* argv[]){
+	if (argc < 3) {
+		cout << "Usage: repeatseq pileup <pileup file>" << endl;
+		return 0;
+	}
+	ifstream in(argv[2], ios::in | ios::binary);
+	char header[8];
+	if (!in.read(header, 8) || memcmp(header, PILEUP_MAGIC, 4) != 0) {
+		cout << "Unable to read pileup file " << argv[2] << endl;
+		return 0;
+	}
+
+	char sizes[12];
+	while (in.read(sizes, 12)) {
+		uLongf compressedBytes = getUint32(sizes), bytes = getUint32(sizes + 4);
+		uint32_t loci = getUint32(sizes + 8);
+		if (!compressedBytes) break;
+		string compressed(compressedBytes, '\0'), block(bytes, '\0');
+		if (!in.read(&compressed[0], compressedBytes)) break;
+		if (uncompress((Bytef*) &block[0], &bytes, (const Bytef*) compressed.data(), compressedBytes) != Z_OK) {
+			cerr << "Corrupt block in " << argv[2] << endl;
+			return 1;
+		}
+		block.resize(bytes);
+		printPileupBlock(block, loci, cout);
+	}
+	cout << flush;
+	return 0;
+}
@@ -0,0 +1,187 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Polyploid module: genotyping polyploid & pooled samples (-ploidy N, N > 2)
+//
+// printGenoPerc() scores every haploid or diploid genotype.  For a ploidy of N, a genotype is a
+// multiset of N allele lengths, too many to score at 10 alleles & N of 8, so genotypePolyploid()
+// scores only the plausible ones.  Alleles with fewer reads than POLYPLOID_MIN_SHARE of a single
+// copy's expected share are dropped (their reads counting as errors), as are all but the
+// POLYPLOID_MAX_ALLELES with the most reads; each remaining allele may only take the numbers of
+// copies within POLYPLOID_Z standard deviations of its share of the reads (or none).  Genotypes
+// are scored in log space with the diploid model generalized: each allele of a genotype has a
+// Dirichlet prior weighted by its number of copies, & the reads of all other alleles are errors.
+// For N of 1 or 2 the weights reduce to the diploid model's.
+
+#include "repeatseq.h"
+#include <algorithm>
+
+#define POLYPLOID_MIN_SHARE 0.2         // of the reads expected of one copy of an allele
+#define POLYPLOID_MAX_ALLELES 16
+#define POLYPLOID_Z 4.0
+
+typedef struct {
+	const vector<GT> * alleles;
+	vector<int> lo, hi;                 // copies each allele may take (beyond 0)
+	vector<int> copies;                 // copies of each allele in the genotype being built
+	int ploidy;
+	int total;                          // reads of all alleles (those dropped included)
+	int unitSize, refLength;
+	double best;                        // log likelihood of the best genotype so far
+	vector<int> bestCopies;
+	vector<double> scores;              // log likelihoods of all genotypes scored
+} polyploid_search_t;
+
+//log likelihood of the genotype in search.copies
+double scorePolyploid(const polyploid_search_t &search){
+	extern int PHI_TABLE[5][5][5][2];
+	const vector<GT> &alleles = *search.alleles;
+	int distinct = 0;
+	for (size_t a = 0; a < alleles.size(); ++a) if (search.copies[a]) ++distinct;
+	
+	double alphaSum = 0, errorAlpha = 1, likelihood = 0, prior = 0;
+	int explained = 0;
+	for (size_t a = 0; a < alleles.size(); ++a) {
+		if (!search.copies[a]) continue;
+		int* ERROR_TABLE = PHI_TABLE[search.unitSize-1][search.refLength/15][int(alleles[a].avgBQ)];
+		double weight = double(search.copies[a] * distinct) / search.ploidy;
+		double alpha = 1 + weight * ERROR_TABLE[0];
+		int n = alleles[a].occurrences;
+		errorAlpha += weight * ERROR_TABLE[1];
+		alphaSum += alpha;
+		likelihood += lgamma(alpha + n) - lgamma(n + 1.0);
+		prior += lgamma(alpha);
+		explained += n;
+	}
+	int errors = search.total - explained;
+	alphaSum += errorAlpha;
+	likelihood += lgamma(errorAlpha + errors) - lgamma(errors + 1.0) - lgamma(alphaSum + search.total);
+	prior += lgamma(errorAlpha) - lgamma(alphaSum);
+	return lgamma(search.total + 1.0) + likelihood - prior;
+}
+
+//score every genotype giving alleles a.. the copies left
+void searchPolyploid(polyploid_search_t &search, size_t a, int left){
+	if (a == search.alleles->size() || !left) {
+		if (left) return;
+		double score = scorePolyploid(search);
+		search.scores.push_back(score);
+		if (search.bestCopies.empty() || score > search.best) {
+			search.best = score;
+			search.bestCopies = search.copies;
+		}
+		return;
+	}
+	for (int copies = min(left, search.hi[a]); copies >= search.lo[a]; --copies) {
+		search.copies[a] = copies;
+		searchPolyploid(search, a + 1, left - copies);
+	}
+	search.copies[a] = 0;
+	searchPolyploid(search, a + 1, left);
+}
+
+//the most likely genotype of N allele lengths (a single length if all N are the same), ordered
+//as vectorGT is; confidence as printGenoPerc() gives it
+vector<int> genotypePolyploid(const vector<GT> &vectorGT, int ref_length, int unit_size, int ploidy, double &confidence){
+	polyploid_search_t search;
+	search.ploidy = ploidy;
+	search.unitSize = unit_size;
+	search.refLength = ref_length;
+	search.total = 0;
+	for (vector<GT>::const_iterator it = vectorGT.begin(); it < vectorGT.end(); ++it) search.total += it->occurrences;
+	
+	//the candidate alleles:
+	vector<GT> alleles;
+	double share = double(search.total) / ploidy;
+	for (vector<GT>::const_iterator it = vectorGT.begin(); it < vectorGT.end(); ++it)
+		if (it->occurrences >= POLYPLOID_MIN_SHARE * share) alleles.push_back(*it);
+	if (alleles.empty()) alleles = vectorGT;
+	if (alleles.size() > POLYPLOID_MAX_ALLELES) {
+		vector<pair<int,size_t> > byReads;
+		for (size_t a = 0; a < alleles.size(); ++a) byReads.push_back(make_pair(-alleles[a].occurrences, a));
+		sort(byReads.begin(), byReads.end());
+		vector<size_t> kept;
+		for (size_t a = 0; a < POLYPLOID_MAX_ALLELES; ++a) kept.push_back(byReads[a].second);
+		sort(kept.begin(), kept.end());
+		vector<GT> top;
+		for (vector<size_t>::iterator it = kept.begin(); it < kept.end(); ++it) top.push_back(alleles[*it]);
+		alleles.swap(top);
+	}
+	
+	//the copies each may take:
+	for (vector<GT>::iterator it = alleles.begin(); it < alleles.end(); ++it) {
+		double fraction = double(it->occurrences) / search.total;
+		double deviation = POLYPLOID_Z * sqrt(fraction * (1 - fraction) / search.total) + 1.0 / ploidy;
+		search.lo.push_back(max(1, int(floor(ploidy * (fraction - deviation)))));
+		search.hi.push_back(min(ploidy, int(ceil(ploidy * (fraction + deviation)))));
+	}
+	search.alleles = &alleles;
+	search.copies.assign(alleles.size(), 0);
+	searchPolyploid(search, 0, ploidy);
+	if (search.scores.empty()) {
+		//the copies allowed can't make up N: let every allele take any number
+		search.hi.assign(alleles.size(), ploidy);
+		searchPolyploid(search, 0, ploidy);
+	}
+	
+	//confidence: -10 log10 of the summed posterior of all other genotypes
+	double others = -INFINITY, all = -INFINITY;
+	bool skipped = false;
+	for (vector<double>::iterator it = search.scores.begin(); it < search.scores.end(); ++it) {
+		all = max(all, *it) + log1p(exp(-fabs(all - *it)));
+		if (!skipped && *it == search.best) skipped = true;
+		else others = max(others, *it) + log1p(exp(-fabs(others - *it)));
+	}
+	confidence = (others == -INFINITY) ? 50 : -10 * (others - all) / log(10.0);
+	if (confidence > 50) confidence = 50;
+	if (confidence != confidence) confidence = 0;
+	
+	vector<int> gts;
+	for (size_t a = 0; a < alleles.size(); ++a) gts.insert(gts.end(), search.bestCopies[a], alleles[a].readlength);
+	if (count(gts.begin(), gts.end(), gts.front()) == ploidy) gts.resize(1);
+	return gts;
+}
+
+//a genotype as printed to the .repeatseq & .calls files ("7h5", or "7h7h7h5" for -ploidy 4)
+string formatGenotype(const vector<int> &gts){
+	stringstream genotype;
+	for (vector<int>::const_iterator it = gts.begin(); it < gts.end(); ++it) genotype << (it == gts.begin() ? "" : "h") << *it;
+	return genotype.str();
+}
+
+//VCF record of a polyploid genotype: as getVCF() writes, with N alleles in GT & the genotype's
+//confidence as GQ (the likelihoods of every genotype aren't computed)
+string getPolyploidVCF(vector<string> alignments, bool differences, string reference, string chr, int start, char precBase, VCF_INFO info, vector<int> gts, double confidence, int ploidy){
+	stringstream vcf;
+	if (!info.emitAll && !differences) return "";
+	if (gts.size() == 1) gts.assign(ploidy, gts[0]);
+	
+	reference.erase(std::remove(reference.begin(), reference.end(), '-'), reference.end());
+	vector<string> alternates;
+	for (vector<string>::iterator it = alignments.begin(); it < alignments.end(); ++it)
+		if (it->length() != reference.length()) alternates.push_back(*it);
+	
+	vcf << chr << '\t' << start - 1 << '\t' << "." << '\t' << precBase << reference << '\t';
+	for (vector<string>::iterator it = alternates.begin(); it < alternates.end(); ++it) vcf << (it == alternates.begin() ? "" : ",") << precBase << *it;
+	if (alternates.empty()) vcf << ".";
+	vcf << '\t' << min(max(confidence, 0.), 50.) << '\t';
+	if (info.timedOut) vcf << "TIMEOUT\t";
+	else if (confidence > 0.8) vcf << "PASS\t";
+	else vcf << ".\t";
+	vcf << "AL=";
+	for (vector<int>::iterator it = gts.begin(); it < gts.end(); ++it) vcf << (it == gts.begin() ? "" : ",") << *it - int(reference.length());
+	vcf << ";RU=" << info.unit << ";DP=" << info.depth << ";RL=" << info.length << "\t";
+	vcf << "GT:GQ\t";
+	sort(gts.begin(), gts.end());
+	for (vector<int>::iterator it = gts.begin(); it < gts.end(); ++it) {
+		if (it != gts.begin()) vcf << '/';
+		if (*it == int(reference.length())) { vcf << 0; continue; }
+		size_t allele = 0;
+		while (allele < alternates.size() && int(alternates[allele].length()) != *it) ++allele;
+		if (allele < alternates.size()) vcf << allele + 1;
+		else vcf << '.';
+	}
+	vcf << ':' << int(min(max(confidence, 0.), 50.)) << '\n';
+	return vcf.str();
+}
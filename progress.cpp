@@ -0,0 +1,210 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Progress module: counts of the work done by the worker threads, reported while the run goes on
+//
+// Each worker counts the region lines it has finished, the reads it has read & their size with
+// lock-free (__sync) updates of its own counters; the region lines finished are also tallied per
+// chromosome.  A reporter thread wakes every few seconds to sum the counters, printing rates,
+// per-chromosome progress & an ETA to stderr and/or rewriting a Prometheus textfile (for the node
+// exporter's textfile collector).  At the end of a run the time each worker spent busy, in BAM I/O,
+// waiting for the threads sharing its deep loci & idle (done with its share while others weren't)
+// can be printed, with the imbalance factor (max/mean busy time) of the static split in main().
+
+#include "repeatseq.h"
+#include <unistd.h>
+
+//chromosomes of the region file, with the number of region lines on each
+void PROGRESS::init(const vector<string> &regions){
+	map<string,int> index;
+	chromosomes.clear();
+	chromosomeOf.resize(regions.size());
+	total.clear();
+	for (size_t line = 0; line < regions.size(); ++line) {
+		string chr = regions[line].substr(0, regions[line].find(':'));
+		map<string,int>::iterator it = index.find(chr);
+		if (it == index.end()) {
+			it = index.insert(make_pair(chr, int(chromosomes.size()))).first;
+			chromosomes.push_back(chr);
+			total.push_back(0);
+		}
+		chromosomeOf[line] = it->second;
+		++total[it->second];
+	}
+	done.assign(total.size(), 0);
+}
+
+//size of a read's record in the (uncompressed) BAM file
+inline long bamRecordSize(const BamAlignment &al){
+	return 36 + al.Name.length() + 1 + 4 * al.CigarData.size() + (al.Length + 1) / 2 + al.Length + al.TagData.length();
+}
+
+void regionDone(worker_data_t &worker, size_t line){
+	__sync_fetch_and_add(&worker.lociDone, 1);
+	__sync_fetch_and_add(&worker.progress->done[worker.progress->chromosomeOf[line]], 1);
+}
+
+void readDone(worker_data_t &worker, const BamAlignment &al){
+	__sync_fetch_and_add(&worker.readsDone, 1);
+	__sync_fetch_and_add(&worker.bytesDone, bamRecordSize(al));
+}
+
+//format seconds as e.g. 1h02m03s
+string formatTime(double seconds){
+	long s = long(seconds + 0.5);
+	stringstream out;
+	if (s >= 3600) out << s / 3600 << 'h' << setfill('0') << setw(2);
+	if (s >= 60) out << (s / 60) % 60 << 'm' << setfill('0') << setw(2);
+	out << s % 60 << 's';
+	return out.str();
+}
+
+//escape a Prometheus label value
+string labelValue(const string &value){
+	string escaped;
+	for (string::const_iterator c = value.begin(); c < value.end(); ++c) {
+		if (*c == '\\' || *c == '"') escaped += '\\';
+		if (*c == '\n') escaped += "\\n";
+		else escaped += *c;
+	}
+	return escaped;
+}
+
+void writeMetric(ostream &out, string name, string type, string help){
+	out << "# HELP repeatseq_" << name << ' ' << help << '\n';
+	out << "# TYPE repeatseq_" << name << ' ' << type << '\n';
+}
+
+void reportProgress(reporter_data_t &reporter, bool final){
+	const PROGRESS &progress = *reporter.progress;
+	const vector<worker_data_t *> &workers = *reporter.workers;
+
+	long loci = 0, reads = 0, bytes = 0, total = progress.chromosomeOf.size();
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		loci += __sync_fetch_and_add(&workers[thread]->lociDone, 0);
+		reads += __sync_fetch_and_add(&workers[thread]->readsDone, 0);
+		bytes += __sync_fetch_and_add(&workers[thread]->bytesDone, 0);
+	}
+
+	//rates are over the last interval, the ETA over the whole run:
+	double now = wallTime(), elapsed = now - reporter.started, interval = now - reporter.lastTime;
+	double lociRate = interval > 0 ? (loci - reporter.lastLoci) / interval : 0;
+	double readRate = interval > 0 ? (reads - reporter.lastReads) / interval : 0;
+	double byteRate = interval > 0 ? (bytes - reporter.lastBytes) / interval : 0;
+	double eta = loci ? (total - loci) * elapsed / loci : -1;
+	reporter.lastTime = now;
+	reporter.lastLoci = loci;
+	reporter.lastReads = reads;
+	reporter.lastBytes = bytes;
+
+	if (reporter.settings->progress) {
+		int chromosomesDone = 0;
+		stringstream chromosomes;
+		for (size_t chr = 0; chr < progress.chromosomes.size(); ++chr) {
+			long chrDone = __sync_fetch_and_add(&reporter.progress->done[chr], 0);
+			if (chrDone == progress.total[chr]) ++chromosomesDone;
+			else if (chrDone) chromosomes << ' ' << progress.chromosomes[chr] << ' ' << 100 * chrDone / progress.total[chr] << '%';
+		}
+
+		stringstream line;
+		line << setiosflags(ios::fixed) << setprecision(1);
+		line << "progress: " << (total ? 100.0 * loci / total : 100.0) << "% (" << loci << '/' << total << " loci) ";
+		if (final) line << "done in " << formatTime(elapsed);
+		else {
+			line << lociRate << " loci/s " << readRate << " reads/s " << byteRate / 1e6 << " MB/s, ETA ";
+			line << (eta < 0 ? "NA" : formatTime(eta));
+		}
+		line << "; " << chromosomesDone << '/' << progress.chromosomes.size() << " chromosomes done" << chromosomes.str() << '\n';
+		cerr << line.str() << flush;
+	}
+
+	if (reporter.settings->metricsFile != "") {
+		string label = "bam=\"" + labelValue(reporter.bam) + "\"";
+		stringstream metrics;
+		writeMetric(metrics, "loci", "gauge", "Lines of the region file.");
+		metrics << "repeatseq_loci{" << label << "} " << total << '\n';
+		writeMetric(metrics, "loci_done_total", "counter", "Lines of the region file finished.");
+		metrics << "repeatseq_loci_done_total{" << label << "} " << loci << '\n';
+		writeMetric(metrics, "reads_total", "counter", "Reads read from the BAM file.");
+		metrics << "repeatseq_reads_total{" << label << "} " << reads << '\n';
+		writeMetric(metrics, "read_bytes_total", "counter", "Uncompressed BAM record bytes read.");
+		metrics << "repeatseq_read_bytes_total{" << label << "} " << bytes << '\n';
+		writeMetric(metrics, "loci_per_second", "gauge", "Loci finished per second over the last interval.");
+		metrics << "repeatseq_loci_per_second{" << label << "} " << lociRate << '\n';
+		writeMetric(metrics, "reads_per_second", "gauge", "Reads read per second over the last interval.");
+		metrics << "repeatseq_reads_per_second{" << label << "} " << readRate << '\n';
+		writeMetric(metrics, "elapsed_seconds", "gauge", "Seconds since the workers started.");
+		metrics << "repeatseq_elapsed_seconds{" << label << "} " << elapsed << '\n';
+		writeMetric(metrics, "eta_seconds", "gauge", "Estimated seconds until the workers finish (-1 if unknown).");
+		metrics << "repeatseq_eta_seconds{" << label << "} " << (final ? 0 : eta) << '\n';
+		writeMetric(metrics, "finished", "gauge", "1 once the workers have finished.");
+		metrics << "repeatseq_finished{" << label << "} " << final << '\n';
+
+		writeMetric(metrics, "chromosome_loci", "gauge", "Lines of the region file on each chromosome.");
+		for (size_t chr = 0; chr < progress.chromosomes.size(); ++chr)
+			metrics << "repeatseq_chromosome_loci{" << label << ",chromosome=\"" << labelValue(progress.chromosomes[chr]) << "\"} " << progress.total[chr] << '\n';
+		writeMetric(metrics, "chromosome_loci_done_total", "counter", "Lines of the region file finished on each chromosome.");
+		for (size_t chr = 0; chr < progress.chromosomes.size(); ++chr)
+			metrics << "repeatseq_chromosome_loci_done_total{" << label << ",chromosome=\"" << labelValue(progress.chromosomes[chr]) << "\"} " << __sync_fetch_and_add(&reporter.progress->done[chr], 0) << '\n';
+		writeMetric(metrics, "worker_loci_done_total", "counter", "Lines of the region file finished by each worker thread.");
+		for (size_t thread = 0; thread < workers.size(); ++thread)
+			metrics << "repeatseq_worker_loci_done_total{" << label << ",worker=\"" << thread << "\"} " << __sync_fetch_and_add(&workers[thread]->lociDone, 0) << '\n';
+
+		//write a temporary file & rename it, so the exporter never reads a partial file
+		string temporary = reporter.settings->metricsFile + ".tmp";
+		ofstream out(temporary.c_str());
+		out << metrics.str();
+		out.close();
+		if (out.fail() || rename(temporary.c_str(), reporter.settings->metricsFile.c_str()) != 0)
+			perror("Error writing metrics file");
+	}
+}
+
+void * reporter_thread(void * pdata){
+	reporter_data_t &reporter = *((reporter_data_t *) pdata);
+	double interval = reporter.settings->progress ? reporter.settings->progress : 15;
+
+	while (!__sync_fetch_and_add(&reporter.stop, 0)) {
+		usleep(100000);
+		if (wallTime() - reporter.lastTime >= interval) reportProgress(reporter, false);
+	}
+
+	return NULL;
+}
+
+void printThreadStats(const vector<worker_data_t *> &workers){
+	if (workers.empty()) return;
+	double first = workers[0]->started, last = workers[0]->finished;
+	for (size_t thread = 1; thread < workers.size(); ++thread) {
+		first = min(first, workers[thread]->started);
+		last = max(last, workers[thread]->finished);
+	}
+	double span = last - first;
+
+	stringstream table;
+	table << setiosflags(ios::fixed) << setprecision(2);
+	table << "thread\tloci\tbusy(s)\tI/O(s)\twait(s)\tidle(s)\tbusy%\n";
+	double totalBusy = 0, maxBusy = 0, helpers = 0;
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		const worker_data_t &worker = *workers[thread];
+		double busy = worker.finished - worker.started - worker.ioTime - worker.waitTime;
+		double idle = span - (worker.finished - worker.started);
+		totalBusy += busy;
+		maxBusy = max(maxBusy, busy);
+		helpers += worker.helperTime;
+		table << thread << '\t' << worker.lociDone << '\t' << busy << '\t' << worker.ioTime << '\t' << worker.waitTime << '\t';
+		table << idle << '\t' << (span > 0 ? 100 * busy / span : 0) << '\n';
+	}
+	long reads = 0;
+	double threadTime = 0;
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		reads += workers[thread]->readsDone;
+		threadTime += workers[thread]->finished - workers[thread]->started + workers[thread]->helperTime;
+	}
+	double meanBusy = totalBusy / workers.size();
+	table << "imbalance (max/mean busy): " << (meanBusy > 0 ? maxBusy / meanBusy : 1) << "; wall time " << span << "s";
+	table << "; threads sharing deep loci were busy " << helpers << "s\n";
+	table << "cost per read: " << (reads ? 1e6 * threadTime / reads : 0) << "us of thread time (-readcost for -dryrun)\n";
+	cerr << table.str() << flush;
+}
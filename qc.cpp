@@ -0,0 +1,114 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// QC module: depth & spanning reads of each locus, without genotyping (-qc)
+//
+// With -qc, reads are fetched without their names, bases & qualities (GetNextAlignmentCore) and
+// dispatchRead() hands each to qcRead() instead of addRead(): the header values print_output()
+// would give a locus are worked out from the position & CIGAR of the read alone.
+//   D: reads covering the middle of the repeat (soft clips lined up as though aligned)
+//   R: reads whose alignment covers both ends of the repeat & -L/-R bases to either side with
+//      matches ('M' or '=', so a mismatch is only seen in '=/X' CIGARs), passing -M, -r, -pp & -multi
+//   S: reads without a CIGAR
+// along with the mean MapQ of the R reads.  Each locus is a line of <in.bam>.qc, & the totals of
+// the run are written to <in.bam>.qc.summary.  No VCF, .repeatseq or .calls records are written.
+
+#include "repeatseq.h"
+#include <string.h>
+
+QC_TOTALS::QC_TOTALS(){
+	loci = spanned = depth = spanning = noCigar = mapQSum = 0;
+}
+
+//true if every reference position from..to-1 is aligned to the read by an operation in types
+bool alignedOver(const vector<CigarOp> &cigar, int position, int from, int to, const char *types){
+	if (from >= to) return true;
+	for (vector<CigarOp>::const_iterator op = cigar.begin(); op != cigar.end() && position < to; ++op) {
+		if (op->Type != 'M' && op->Type != 'D' && op->Type != 'N' && op->Type != '=' && op->Type != 'X') continue;
+		int end = position + op->Length;
+		if (end > from && !strchr(types, op->Type)) return false;
+		if (position <= from && end > from) from = end;     //covered up to here
+		position = end;
+		if (from >= to) return true;
+	}
+	return false;
+}
+
+void qcRead(const LOCUS &locus, LOCUS_READS &reads, const BamAlignment &al, const SETTINGS_FILTERS &settings){
+	const vector<CigarOp> &cigar = al.CigarData;
+	if (cigar.empty()) {
+		reads.numStars++;
+		return;
+	}
+	
+	//D: the middle of the repeat falls within the read
+	int leadClip = cigar.front().Type == 'S' ? cigar.front().Length : 0;
+	int trailClip = cigar.back().Type == 'S' ? cigar.back().Length : 0;
+	int middle = locus.left + locus.target.length()/2;
+	if (al.Position - leadClip <= middle && middle < al.GetEndPosition() + trailClip) ++reads.depth;
+	
+	//R: the repeat's ends are aligned & its flanks matched
+	if (!alignedOver(cigar, al.Position, locus.left, locus.left + 1, "M=XD")) return;
+	if (!alignedOver(cigar, al.Position, locus.right, locus.right + 1, "M=XD")) return;
+	if (!alignedOver(cigar, al.Position, locus.left - settings.consLeftFlank, locus.left, "M=")) return;
+	if (!alignedOver(cigar, al.Position, locus.right + 1, locus.right + 1 + settings.consRightFlank, "M=")) return;
+	
+	int readSize = 0;
+	for (vector<CigarOp>::const_iterator op = cigar.begin(); op != cigar.end(); ++op)
+		if (op->Type == 'M' || op->Type == 'I' || op->Type == 'S' || op->Type == '=' || op->Type == 'X') readSize += op->Length;
+	if (settings.readLengthMin && readSize < settings.readLengthMin) return;
+	if (settings.readLengthMax && readSize > settings.readLengthMax) return;
+	if (al.MapQuality < settings.MapQuality) return;
+	string stringXT;
+	if (settings.multi && al.GetTag("XT", stringXT) && stringXT.find('R') != string::npos) return;
+	if (settings.properlyPaired && !al.IsProperPair()) return;
+	
+	++reads.spanning;
+	reads.mapQSum += al.MapQuality;
+}
+
+//the line of a locus in the .qc file
+void qcLocus(const LOCUS &locus, const LOCUS_READS &reads, stringstream &qcFile, QC_TOTALS &totals){
+	qcFile << locus.region << '\t' << locus.UnitSeq << '\t' << locus.target.length() << '\t';
+	qcFile << reads.depth << '\t' << reads.spanning << '\t' << reads.numStars << '\t';
+	if (reads.spanning) qcFile << float(int(100.0 * reads.mapQSum / reads.spanning)) / 100 << '\n';
+	else qcFile << "NA\n";
+	
+	++totals.loci;
+	if (reads.spanning) ++totals.spanned;
+	totals.depth += reads.depth;
+	totals.spanning += reads.spanning;
+	totals.noCigar += reads.numStars;
+	totals.mapQSum += reads.mapQSum;
+}
+
+//write the .qc file & its summary
+bool writeQC(string filename, const vector<worker_data_t *> &workers){
+	ofstream out(filename.c_str());
+	if (!out.is_open()) return false;
+	out << "#region\tunit\tref_length\tdepth\tspanning\tno_cigar\tmean_mapq\n";
+	QC_TOTALS totals;
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		worker_data_t &data = *workers[thread];
+		if (data.qcFile.rdbuf()->in_avail()) out << data.qcFile.rdbuf();
+		totals.loci += data.qcTotals.loci;
+		totals.spanned += data.qcTotals.spanned;
+		totals.depth += data.qcTotals.depth;
+		totals.spanning += data.qcTotals.spanning;
+		totals.noCigar += data.qcTotals.noCigar;
+		totals.mapQSum += data.qcTotals.mapQSum;
+	}
+	
+	ofstream summary((filename + ".summary").c_str());
+	if (!summary.is_open()) return false;
+	summary << "loci\t" << totals.loci << '\n';
+	summary << "loci_spanned\t" << totals.spanned << '\n';
+	summary << "mean_depth\t" << (totals.loci ? double(totals.depth) / totals.loci : 0) << '\n';
+	summary << "mean_spanning\t" << (totals.loci ? double(totals.spanning) / totals.loci : 0) << '\n';
+	summary << "reads_no_cigar\t" << totals.noCigar << '\n';
+	summary << "mean_mapq\t";
+	if (totals.spanning) summary << double(totals.mapQSum) / totals.spanning << '\n';
+	else summary << "NA\n";
+	return !out.fail() && !summary.fail();
+}
@@ -0,0 +1,202 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Realign module: realigning reads against the candidate alleles of a locus (-realign N)
+//
+// initLocus() builds the haplotypes of a locus once: REALIGN_FLANK bases of the reference on
+// either side of the repeat, around the reference repeat with up to N units added or removed
+// (the unit being the last unitLength bases of the repeat).  Each haplotype keeps a striped
+// query profile (Farrar, 2007) of its scores against each base, reused for every read of the
+// locus.  addRead() cuts from the read the window of bases where the locus is expected (from the
+// alignment start, REALIGN_FLANK & N units to either side) & scores it against each haplotype
+// with a local Smith-Waterman, 8 cells a step in SSE2 registers (scalar on other processors).
+// The alignment isn't banded: every cell of window & haplotype is scored, which both being cut to
+// the locus & its flanks keeps to a few thousand cells for short repeats.  The H & E rows are
+// scratch the locus' LOCUS_READS holds, sized for its longest haplotype with the first read.
+// If one haplotype scores higher than all others, its allele length (& sequence) replaces the
+// one read from the CIGAR; on a tie the CIGAR's is kept, so reads that stop inside the repeat
+// or are realigned equally well to several alleles keep their aligner-given length.
+
+#include "repeatseq.h"
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define REALIGN_FLANK 20        // reference bases on either side of the haplotypes
+#define REALIGN_MATCH 2
+#define REALIGN_MISMATCH 4
+#define REALIGN_GAP_OPEN 6      // the first base of a gap costs REALIGN_GAP_OPEN + REALIGN_GAP_EXTEND
+#define REALIGN_GAP_EXTEND 1
+#define REALIGN_LANES 8         // 16-bit scores per 128-bit register
+
+//2-bit code of a base, 4 for anything else
+inline int realignCode(char c){
+	switch (c) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+	}
+	return 4;
+}
+
+//the striped profile of a haplotype: for each base code, segments of REALIGN_LANES scores where
+//lane k of segment i scores the base against position i + k * segments of the haplotype
+void buildProfile(HAPLOTYPE &haplotype){
+	const string &bases = haplotype.bases;
+	int segments = (bases.length() + REALIGN_LANES - 1) / REALIGN_LANES;
+	haplotype.segments = segments;
+	haplotype.profile.assign(5 * segments * REALIGN_LANES, 0);
+	for (int code = 0; code < 5; ++code) {
+		for (int i = 0; i < segments; ++i) {
+			for (int k = 0; k < REALIGN_LANES; ++k) {
+				size_t position = i + k * segments;
+				int16_t score = 0;      //padding past the haplotype scores nothing
+				if (position < bases.length()) score = (code < 4 && realignCode(bases[position]) == code) ? REALIGN_MATCH : -REALIGN_MISMATCH;
+				haplotype.profile[(code * segments + i) * REALIGN_LANES + k] = score;
+			}
+		}
+	}
+}
+
+//the haplotypes of a locus: its repeat with -units..+units units, within REALIGN_FLANK bases of reference
+void buildHaplotypes(LOCUS &locus, FastaReference *fr, const SETTINGS_FILTERS &settings){
+	const Region &target = locus.target;
+	const string &center = locus.centerReference;
+	int chrLength = fr->sequenceLength(target.startSeq);
+	int leftStart = max(0, target.startPos - 1 - REALIGN_FLANK);
+	int rightStart = target.startPos - 1 + target.length();
+	string left = fr->getSubSequence(target.startSeq, leftStart, target.startPos - 1 - leftStart);
+	string right = fr->getSubSequence(target.startSeq, rightStart, max(0, min(REALIGN_FLANK, chrLength - rightStart)));
+	upperCase(left);
+	upperCase(right);
+
+	int unitLength = max(1, locus.unitLength);
+	string unit = int(center.length()) >= unitLength ? center.substr(center.length() - unitLength) : locus.UnitSeq;
+	locus.haplotypes.clear();
+	locus.realignFlank = left.length();
+	for (int units = -settings.realignUnits; units <= settings.realignUnits; ++units) {
+		HAPLOTYPE haplotype;
+		if (units < 0) {
+			if (int(center.length()) <= -units * unitLength) continue;
+			haplotype.allele = center.substr(0, center.length() + units * unitLength);
+		}
+		else {
+			haplotype.allele = center;
+			for (int i = 0; i < units; ++i) haplotype.allele += unit;
+		}
+		haplotype.bases = left + haplotype.allele + right;
+		buildProfile(haplotype);
+		locus.haplotypes.push_back(haplotype);
+	}
+}
+
+//scores realignScore() keeps for a haplotype
+size_t realignWork(const HAPLOTYPE &haplotype){
+#ifdef __SSE2__
+	return 3 * haplotype.segments * REALIGN_LANES;
+#else
+	return 2 * (haplotype.bases.length() + 1);
+#endif
+}
+
+//best local alignment score of a read against a haplotype, in realignWork() scores of scratch
+int realignScore(const HAPLOTYPE &haplotype, const char *read, int length, int16_t *work){
+	int segments = haplotype.segments;
+	fill(work, work + realignWork(haplotype), 0);
+#ifdef __SSE2__
+	//scores of the previous & current read base against the haplotype, & of gaps in the haplotype:
+	__m128i *storeH = (__m128i *) work, *loadH = storeH + segments, *E = loadH + segments;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i gapOpen = _mm_set1_epi16(REALIGN_GAP_OPEN + REALIGN_GAP_EXTEND), gapExtend = _mm_set1_epi16(REALIGN_GAP_EXTEND);
+	__m128i best = zero;
+	for (int j = 0; j < length; ++j) {
+		const __m128i *profile = (const __m128i *) &haplotype.profile[realignCode(read[j]) * segments * REALIGN_LANES];
+		__m128i F = zero;
+		__m128i H = _mm_slli_si128(_mm_loadu_si128(storeH + segments - 1), 2);      //diagonal of the first row of each lane
+		swap(storeH, loadH);
+		for (int i = 0; i < segments; ++i) {
+			H = _mm_adds_epi16(H, _mm_loadu_si128(profile + i));
+			H = _mm_max_epi16(H, _mm_loadu_si128(E + i));
+			H = _mm_max_epi16(H, F);
+			H = _mm_max_epi16(H, zero);
+			best = _mm_max_epi16(best, H);
+			_mm_storeu_si128(storeH + i, H);
+			H = _mm_subs_epi16(H, gapOpen);
+			_mm_storeu_si128(E + i, _mm_max_epi16(_mm_subs_epi16(_mm_loadu_si128(E + i), gapExtend), H));
+			F = _mm_max_epi16(_mm_subs_epi16(F, gapExtend), H);
+			H = _mm_loadu_si128(loadH + i);
+		}
+		//carry gaps along the haplotype across segments (lazy F); F at or below 0 can't raise a cell
+		F = _mm_slli_si128(F, 2);
+		for (int i = 0; ; ) {
+			H = _mm_loadu_si128(storeH + i);
+			if (!_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi16(F, _mm_subs_epi16(H, gapOpen)), _mm_cmpgt_epi16(F, zero)))) break;
+			H = _mm_max_epi16(H, F);
+			_mm_storeu_si128(storeH + i, H);
+			best = _mm_max_epi16(best, H);
+			_mm_storeu_si128(E + i, _mm_max_epi16(_mm_loadu_si128(E + i), _mm_subs_epi16(H, gapOpen)));
+			F = _mm_subs_epi16(F, gapExtend);
+			if (++i == segments) {
+				i = 0;
+				F = _mm_slli_si128(F, 2);
+			}
+		}
+	}
+	int16_t lanes[REALIGN_LANES];
+	_mm_storeu_si128((__m128i *) lanes, best);
+	return *max_element(lanes, lanes + REALIGN_LANES);
+#else
+	//the same recurrences, a cell at a time:
+	const string &bases = haplotype.bases;
+	int m = bases.length(), best = 0;
+	int16_t *H = work, *E = work + m + 1;
+	for (int j = 0; j < length; ++j) {
+		int diagonal = 0, F = 0;
+		for (int i = 1; i <= m; ++i) {
+			int score = (realignCode(read[j]) < 4 && realignCode(read[j]) == realignCode(bases[i-1])) ? REALIGN_MATCH : -REALIGN_MISMATCH;
+			E[i] = max(E[i] - REALIGN_GAP_EXTEND, H[i] - REALIGN_GAP_OPEN - REALIGN_GAP_EXTEND);
+			F = max(F - REALIGN_GAP_EXTEND, H[i-1] - REALIGN_GAP_OPEN - REALIGN_GAP_EXTEND);
+			int h = max(max(0, diagonal + score), max(int(E[i]), F));
+			diagonal = H[i];
+			H[i] = h;
+			best = max(best, h);
+		}
+	}
+	return best;
+#endif
+}
+
+//the allele length of a read realigned against the haplotypes of its locus (& the allele's
+//sequence), or -1 if no haplotype scores higher than all the others; work is the locus' scratch
+int realignRead(const LOCUS &locus, const BamAlignment &al, const PROJECTION &proj, const SETTINGS_FILTERS &settings, vector<int16_t> &work, string &allele){
+	if (locus.haplotypes.size() < 2) return -1;
+	if (work.empty()) {
+		size_t size = 0;
+		for (vector<HAPLOTYPE>::const_iterator h = locus.haplotypes.begin(); h < locus.haplotypes.end(); ++h) size = max(size, realignWork(*h));
+		work.resize(size);
+	}
+	const string &read = al.QueryBases;
+	int margin = locus.realignFlank + settings.realignUnits * max(1, locus.unitLength);
+	int offset = proj.queryStart + locus.target.startPos - proj.alignStart + proj.clipShift;     //read position of the repeat
+	int first = max(0, offset - margin);
+	int last = min(int(read.length()), offset + locus.target.length() + margin);
+	if (first >= last) return -1;
+
+	int best = -1, bestScore = -1;
+	bool tie = false;
+	for (size_t h = 0; h < locus.haplotypes.size(); ++h) {
+		int score = realignScore(locus.haplotypes[h], read.data() + first, last - first, &work[0]);
+		if (score > bestScore) {
+			bestScore = score;
+			best = h;
+			tie = false;
+		}
+		else if (score == bestScore) tie = true;
+	}
+	if (tie) return -1;
+	allele = locus.haplotypes[best].allele;
+	return allele.length();
+}
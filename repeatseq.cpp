@@ -9,19 +9,23 @@
  See "repeatseq.h" for function & custom data structure declarations
  
  This .cpp contains functions: 
-  (1) main() - Parse command line options, iterate line by line through the TRF file (calling 
-               print_output() on each region).
+  (1) main() - Parse command line options, read in the TRF file & hand each worker thread its 
+               share of the regions (scanRegions()).
+
+  (2) scanRegions() - Groups neighbouring repeats into runs that are read from the BAM file 
+                      together; each read is passed to addRead() for every repeat it overlaps.
                
-  (2) print_output() - This function is called for each repeat in the repeat file, and 
-		       handles the calling of other functions to determine genotype and print 
-                       data to files.
+  (3) print_output() - This function is called for each repeat in the repeat file once its reads 
+		       are collected, and handles the calling of other functions to determine 
+                       genotype and print data to files.
 
-  (3) parseCigar() - Uses CIGAR sequence to align read with reference sequence.
+  (4) parseCigar() - Uses CIGAR sequence to align read with reference sequence (once per read; 
+                     projectLocus() then cuts out the window of each repeat).
  
-  (4) printGenoPerc() - perform statistical analysis to determine most likely genotype and its 
+  (5) printGenoPerc() - perform statistical analysis to determine most likely genotype and its 
                         likelihood.
  
-  (5) getVCF() - print variant record to VCF file.
+  (6) getVCF() - print variant record to VCF file.
 */
 
 #include "repeatseq.h"
@@ -51,57 +55,90 @@ double getLogFactorial(int x) {
 	}
 }
 
-typedef struct worker_data {
-    worker_data(const SETTINGS_FILTERS & settings, const vector<string> & regions)
-    : settings(settings)
-    , regions(regions)
-    {}
-    FastaReference * fr;
-    stringstream vcfFile, oFile, callsFile;
-    const SETTINGS_FILTERS & settings;
-    const vector<string> & regions;
-    size_t region_start, region_stop;
-    pthread_t thread;
-    BamReader reader;
-} worker_data_t;
+//load log_factorial vector
+void initLogFactorial(){
+	double val = 0;
+	for (int i=1; i < LOG_FACTORIAL_SIZE; ++i){
+		val += log(i);
+		log_factorial[i] = val;
+	}
+}
+
+//number of worker threads that have finished their share of the regions; deep loci
+//split their reads among this many extra threads
+int idleWorkers = 0;
 
 void * worker_thread(void * pdata) {
     worker_data_t & worker_data = *((worker_data_t *) pdata);
     
-    for(size_t i = worker_data.region_start; i != worker_data.region_stop; i++)
-        print_output(worker_data.regions[i], worker_data.fr, worker_data.vcfFile, worker_data.oFile, worker_data.callsFile, worker_data.settings, worker_data.reader);
+    stringstream name;
+    name << "worker " << worker_data.id;
+    traceThread(name.str());
+    perfThread();
+    
+    worker_data.started = wallTime();
+    scanRegions(worker_data);
+    flushGVCFBlock(worker_data.gvcfBlock, worker_data.vcfFile, worker_data.settings);
+    writeCaptures(worker_data);
+    worker_data.finished = wallTime();
+    perfThreadDone();
+    traceEvent("scanRegions", worker_data.started, "", worker_data.finished);
+    __sync_fetch_and_add(&idleWorkers, 1);
 
     return NULL;
 }
 
 int main(int argc, char* argv[]){
+    if (argc > 1 && string(argv[1]) == "replay") return replayBundle(argc, argv);
+    if (argc > 1 && string(argv[1]) == "columns") return printColumns(argc, argv);
+    if (argc > 1 && string(argv[1]) == "pileup") return printPileup(argc, argv);
+    if (argc > 1 && string(argv[1]) == "view") return viewOutput(argc, argv);
+    if (argc > 1 && string(argv[1]) == "discover") return discoverRepeats(argc, argv);
+    if (argc > 1 && string(argv[1]) == "fastq") return scanFastq(argc, argv);
+    return runRepeatseq(argc, argv);
+}
 
-    
+//a run over a BAM file, a FASTA file & a region file
+int runRepeatseq(int argc, char* argv[]){
     ofstream oFile, callsFile, vcfFile;
 	try{
 		SETTINGS_FILTERS settings;	
 		srand( time(NULL) );
 		string bam_file = "", fasta_file = "", position_file = "", region;
 		
-		//load log_factorial vector
-		double val = 0; 	
-		for (int i=1; i < LOG_FACTORIAL_SIZE; ++i){
-			val += log(i);
-			log_factorial[i] = val;
-		}
+		initLogFactorial();
 
 		//parse arguments, store in settings:
 		parseSettings(argv, argc, settings, bam_file, fasta_file, position_file);
 		if (bam_file == "") { throw "NO BAM FILE"; }
 		if (fasta_file == "") { throw "NO FASTA FILE"; }
 		if (position_file == "") { throw "NO POSITION FILE"; }
+		initTrace(settings);
+		traceThread("main");
+		initPerf(settings);
 		
 		//create index filepaths & output filepaths (ensuring output is to current directory):
 		string fasta_index_file = fasta_file + ".fai";
 		string bam_index_file = bam_file + ".bai";
 		string output_filename = setToCD(bam_file + settings.paramString + ".repeatseq");
 		string calls_filename = setToCD(bam_file + settings.paramString + ".calls");
-		string vcf_filename = setToCD(bam_file + settings.paramString + ".vcf");
+		string vcf_filename = setToCD(bam_file + settings.paramString + (settings.gvcf ? ".g.vcf" : ".vcf"));
+		string columns_filename = setToCD(bam_file + settings.paramString + ".columns");
+		string pileup_filename = setToCD(bam_file + settings.paramString + ".pileup");
+		string summary_filename = setToCD(bam_file + settings.paramString + ".summary");
+		string qc_filename = setToCD(bam_file + settings.paramString + ".qc");
+		
+		//read in the region file
+		ifstream range_file(position_file.c_str());
+		if (!range_file.is_open()) { throw "Unable to open input range file."; }
+        double reading = wallTime();
+        vector<string> regions;
+		while(getline(range_file,region))
+            regions.push_back(region);
+        traceEvent("read region file", reading);
+        
+		//estimate the resources of the run from the BAM index, without genotyping:
+		if (settings.dryRun) return dryRun(settings, bam_file, bam_index_file, regions);
 		
 		//open FastaReference object (creating fasta index file if needed):
 		if (!fileCheck(fasta_index_file)) {
@@ -109,25 +146,29 @@ int main(int argc, char* argv[]){
 			buildFastaIndex(fasta_file);
 		}
 
-		//open input & output filestreams:
+		//open output filestreams:
 		if (settings.makeRepeatseqFile){ oFile.open(output_filename.c_str()); }
 	 	if (settings.makeCallsFile){ callsFile.open(calls_filename.c_str()); }
-		vcfFile.open(vcf_filename.c_str());
-		ifstream range_file(position_file.c_str());
-		if (!range_file.is_open()) { throw "Unable to open input range file."; }
-		
-		//print VCF header information:
-		printHeader(vcfFile);
+		if (!settings.qc) {
+			vcfFile.open(vcf_filename.c_str());
+			
+			//print VCF header information:
+			printHeader(vcfFile, settings);
+		}
 		
-        //read in the region file
-        vector<string> regions;
-		while(getline(range_file,region))
-            regions.push_back(region);
-        
         long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
         vector<worker_data_t *> thread_worker_data;
         
+        //the BAM index also gives depth estimates, used to find deep loci
+        BaiIndex index;
+        bool haveIndex = settings.deepReads && index.load(bam_index_file);
+        
+        //lines of the region file per chromosome, for progress reports
+        PROGRESS progress;
+        progress.init(regions);
+        
         //set up threads to actually print the output
+        double opening = wallTime();
         for(int thread = 0; thread != num_threads; thread++) {
             thread_worker_data.push_back(new worker_data_t(settings, regions));
             worker_data_t & data = *(thread_worker_data.back());
@@ -136,6 +177,9 @@ int main(int argc, char* argv[]){
 
             data.fr = new FastaReference();
             data.fr->open(fasta_file);
+            data.index = haveIndex ? &index : NULL;
+            data.progress = &progress;
+            data.id = thread;
 
             data.region_start = thread * (regions.size() / num_threads);
             if(thread == num_threads - 1)
@@ -143,6 +187,7 @@ int main(int argc, char* argv[]){
             else
                 data.region_stop = (thread+1) * (regions.size() / num_threads);
         }
+        traceEvent("open workers", opening);
         
         //start worker threads
         for(int thread = 0; thread != num_threads; thread++) {
@@ -150,15 +195,45 @@ int main(int argc, char* argv[]){
                 perror("Error starting worker thread");
         }
         
+        //start the progress reporter
+        reporter_data_t reporter;
+        reporter.settings = &settings;
+        reporter.workers = &thread_worker_data;
+        reporter.progress = &progress;
+        reporter.bam = bam_file;
+        reporter.started = reporter.lastTime = wallTime();
+        reporter.lastLoci = reporter.lastReads = reporter.lastBytes = 0;
+        reporter.stop = 0;
+        bool reporting = (settings.progress || settings.metricsFile != "");
+        if(reporting && 0 != pthread_create(&reporter.thread, NULL, reporter_thread, &reporter)) {
+            perror("Error starting progress reporter");
+            reporting = false;
+        }
+        
         //wait for all workers to finish
+        double waiting = wallTime();
         for(int thread = 0; thread != num_threads; thread++) {
             if(0 != pthread_join(thread_worker_data[thread]->thread, NULL))
                 perror("Error closing worker thread");
         }
+        traceEvent("wait for workers", waiting);
+        
+        if(reporting) {
+            __sync_fetch_and_add(&reporter.stop, 1);
+            if(0 != pthread_join(reporter.thread, NULL))
+                perror("Error closing progress reporter");
+            reportProgress(reporter, true);
+        }
+        
+        if(settings.threadStats) printThreadStats(thread_worker_data);
         
         //consolidate results from the worker threads
+        perfThread();
+        PERF_MARK consolidation;
+        perfBegin(STAGE_CONSOLIDATE, consolidation);
         for(int thread = 0; thread != num_threads; thread++) {
             worker_data_t & data = *thread_worker_data[thread];
+            double consolidating = wallTime();
         
             if(data.vcfFile.rdbuf()->in_avail())
                 vcfFile << data.vcfFile.rdbuf();
@@ -170,107 +245,112 @@ int main(int argc, char* argv[]){
             if (data.callsFile.rdbuf()->in_avail() && settings.makeCallsFile) {
                 callsFile << data.callsFile.rdbuf();
             }
+            
+            stringstream worker;
+            worker << "worker " << thread;
+            traceEvent("consolidate", consolidating, worker.str());
         }
+        if (settings.makeRepeatseqFile && !writeOutputIndex(output_filename + ".rsi", thread_worker_data, false))
+            cerr << "Could not write " << output_filename << ".rsi" << endl;
+        if (settings.makeCallsFile && !writeOutputIndex(calls_filename + ".rsi", thread_worker_data, true))
+            cerr << "Could not write " << calls_filename << ".rsi" << endl;
+        if (settings.columns && !writeColumns(columns_filename, thread_worker_data))
+            cerr << "Could not write " << columns_filename << endl;
+        if (settings.pileup && !writePileup(pileup_filename, thread_worker_data))
+            cerr << "Could not write " << pileup_filename << endl;
+        if (settings.summary && !writeSummary(summary_filename, thread_worker_data))
+            cerr << "Could not write " << summary_filename << endl;
+        if (settings.qc && !writeQC(qc_filename, thread_worker_data))
+            cerr << "Could not write " << qc_filename << endl;
+        perfEnd(consolidation);
+        perfThreadDone();
+        printPerfStats();
+        printAllocStats();
+        writeTrace(settings.traceFile);
 	}
 	catch(const char* exOutput) {
 		cout << endl << exOutput << endl;
 		printArguments();
 		return 0;
 	}	
+	return 0;
 }
 
-inline string parseCigar(stringstream &cigarSeq, string &alignedSeq, string &QS, vector<string> & insertions, int alignStart, int refStart, int LR_CHARS_TO_PRINT, double &avgBQ){
-	int reserveSize = alignedSeq.length() + 500;
-
-	//reserve sufficient space (so iterators remain valid)
-	alignedSeq.reserve(reserveSize);
-	string tempInsertions = "";
-	tempInsertions.reserve(reserveSize);
+// parseCigar() walks the CIGAR of a read once, lining its bases up against the reference: deleted
+// bases are added as '-', inserted bases are replaced by 'd' (the base before them is lower-cased to
+// mark the insertion) and soft-clipped bases by 'S'.  Each reference-consuming position is recorded
+// so that projectLocus() can cut out the window of every locus the read overlaps.
+void parseCigar(const BamAlignment &al, PROJECTION &proj){
+	proj.alignStart = al.Position + 1;
+	proj.clipShift = (!al.CigarData.empty() && al.CigarData.front().Type == 'S') ? al.CigarData.front().Length : 0;
+	proj.queryStart = 0;
+	proj.readSize = 0;
+	proj.valid = true;
 	
-	//iterators & other variables
-	string::iterator it=alignedSeq.begin();
-	string::iterator START;
-	char cigChar;
-	int cigLength;	
-	bool STARTset = 0;
-	int posLeft = refStart - alignStart;
-	int posLeftINS = refStart - alignStart - LR_CHARS_TO_PRINT;
-	bool firstRun = true;
+	//reserve sufficient space for the read & its deletions
+	int reserveSize = al.QueryBases.length();
+	for (vector<CigarOp>::const_iterator op = al.CigarData.begin(); op != al.CigarData.end(); ++op) {
+		if (op->Type == 'D') reserveSize += op->Length;
+		if (op->Type == 'M' || op->Type == 'I' || op->Type == 'S' || op->Type == '=' || op->Type == 'X') proj.readSize += op->Length;
+	}
+	proj.expanded.reserve(reserveSize);
+	proj.steps.reserve(reserveSize);
 	
 	//determine average base quality:
-	avgBQ = 0;
-	for (int i=0; i<QS.length(); ++i){ avgBQ += PhredToFloat(QS[i]); }
-	avgBQ /= QS.length();
-
-	cigarSeq.clear();
-	while (!cigarSeq.eof()) {
-		//parse:
-		cigLength = -1;
-		cigarSeq >> cigLength;
-		cigarSeq >> cigChar;
+	proj.avgBQ = 0;
+	for (int i=0; i<al.Qualities.length(); ++i){ proj.avgBQ += PhredToFloat(al.Qualities[i]); }
+	proj.avgBQ /= al.Qualities.length();
+	
+	walkCigar(al.CigarData.begin(), al.CigarData.end(), al.QueryBases, 0, proj);
+}
+
+//line up the bases of a run of CIGAR operations, starting at QueryBases[q] (see parseCigar())
+void walkCigar(vector<CigarOp>::const_iterator first, vector<CigarOp>::const_iterator last, const string &QB, size_t q, PROJECTION &proj){
+	proj.expanded.clear();
+	proj.steps.clear();
+	proj.insertions.clear();
+	
+	for (vector<CigarOp>::const_iterator op = first; op != last; ++op) {
+		int cigLength = op->Length;
 		
-		//Perform operations on aligned seq:
-		switch(cigChar) {
+		switch(op->Type) {
 			case 'M':                   //MATCH to the reference
+			case '=':
+			case 'X':
 				for (int i = cigLength; i>0; i--) {
-					if (posLeft>0) {
-						posLeft--;
-						posLeftINS--;
-					}
-					else if (!STARTset) {
-						START = it;
-						STARTset = 1;
-					}
-					it++;
+					proj.steps.push_back(proj.expanded.length());
+					proj.expanded += QB[q++];
 				}
-				
 				break;
 				
-			case 'I':                  //INSERTION to the reference
-				tempInsertions = "";
-				*(it-1) += 32;	//convert previous letter to lower case (to mark the following insertion)
+			case 'I': {                 //INSERTION to the reference
+				string tempInsertions = "";
+				if (!proj.expanded.empty()) proj.expanded[proj.expanded.length()-1] += 32;	//convert previous letter to lower case (to mark the following insertion)
 				
 				for (int i = cigLength; i>0; i--) {
-					tempInsertions += *it + 1;
-					*it = 'd';         //convert to d's to remove later
-					++it;
+					tempInsertions += QB[q++] + 1;
+					proj.expanded += 'd';         //d's are removed later
 				}
-				if (posLeftINS <= 0) { insertions.push_back(tempInsertions); }
-				
+				proj.insertions.push_back(pair<int,string>(proj.steps.size(), tempInsertions));
 				break;
+			}
 				
-			case 'D':                       //DELETION from the reference
+			case 'D':                   //DELETION from the reference
 				for (int i = cigLength; i>0; i--) {
-					alignedSeq.insert(it, 1, '-');	//inserts - into the aligned seq
-					posLeft--; 
-					posLeftINS--;
-					if (posLeft < 0 && !STARTset) {
-						START = it;
-						STARTset = 1;
-					}
-					++it;
+					proj.steps.push_back(proj.expanded.length());
+					proj.expanded += '-';
 				}
 				break;
 				
-			case 'N':       //SKIPPED region from the reference
-				return "";	//fail the read (return null string)
-				
-			case 'S':                       //SOFT CLIP on the read (clipped sequence present in <seq>)
-				if (firstRun && !STARTset) posLeft+=cigLength;
-				else if (firstRun) START -= cigLength;
+			case 'N':                   //SKIPPED region from the reference
+				proj.valid = false;     //fail the read
+				return;
 				
+			case 'S':                   //SOFT CLIP on the read (clipped sequence present in <seq>)
 				for (int i = cigLength; i>0; i--) {
-					if (posLeft>0) {
-						posLeft--;
-						posLeftINS--;
-					}
-					else if (!STARTset) {
-						START = it;
-						STARTset = 1;
-					}
-					
-					*it = 'S';				//mark as soft-clipped
-					++it;
+					proj.steps.push_back(proj.expanded.length());
+					proj.expanded += 'S';   //mark as soft-clipped
+					++q;
 				}
 				break;
 				
@@ -278,59 +358,57 @@ inline string parseCigar(stringstream &cigarSeq, string &alignedSeq, string &QS,
 				break;
 				
 			case 'P':   //PADDING (silent deletion from the padded reference sequence)
-				if (posLeft>0) {
-					posLeft--;
-					posLeftINS--;
-				}
-				else if (!STARTset) {
-					START = it;
-					STARTset = 1;
-				}
-				
-				it += cigLength;
+				proj.steps.push_back(proj.expanded.length());
+				for (int i = cigLength; i>0 && q < QB.length(); i--) proj.expanded += QB[q++];
 				break;
 		}       //end case
-		firstRun = 0;
 	}
+}
+
+// projectLocus() cuts the window for the locus starting at refStart out of a parsed read: 
+// LR_CHARS_TO_PRINT bases (plus any inserted bases) ahead of the locus followed by the rest of the
+// read, along with the insertions from LR_CHARS_TO_PRINT reference bases before the locus onwards.
+bool projectLocus(const PROJECTION &proj, int refStart, int LR_CHARS_TO_PRINT, string &PreAlignedPost, vector<string> &insertions){
+	if (!proj.valid) return false;
 	
-	int offset = alignStart - refStart;
-	if (!STARTset) {
-		START = alignedSeq.begin();
-		while ((offset--) > 0) { alignedSeq.insert(alignedSeq.begin(),1,'x'); }
-	}
-	int numD = 0;
-	for (string::iterator ii = START; ii > START - LR_CHARS_TO_PRINT && ii >= alignedSeq.begin(); --ii) {
-		if (*ii == 'd') numD++;
+	const string &expanded = proj.expanded;
+	int posLeft = refStart - proj.alignStart;
+	
+	insertions.clear();
+	for (vector<pair<int,string> >::const_iterator it = proj.insertions.begin(); it != proj.insertions.end(); ++it) {
+		if (posLeft - it->first <= LR_CHARS_TO_PRINT) insertions.push_back(it->second);
 	}
 	
-	string temp = "";
-	temp.reserve(500);
+	//the locus begins at the first reference-consuming position at or after refStart
+	//(a leading soft clip is lined up as though it were aligned):
+	int first = max(0, posLeft + proj.clipShift);
+	int START = 0, lead = 0;
+	if (first < int(proj.steps.size())) START = proj.steps[first];
+	else if (posLeft < 0) lead = -posLeft;      //nothing to anchor the read to; pad it with x's
 	
-	string::iterator ii = START;
-	for (int i = 0; i < numD + LR_CHARS_TO_PRINT; ++i) {
-		if (ii > alignedSeq.begin()) {
-			--ii;
-			temp.insert(0,1,*ii);
-		}
-		else {
-			temp.insert(0,1,'x');
-		}
+	int numD = 0;
+	for (int ii = START; ii > START - LR_CHARS_TO_PRINT && ii >= 0; --ii) {
+		if (ii >= lead && ii - lead < int(expanded.length()) && expanded[ii - lead] == 'd') numD++;
 	}
+	int numPre = numD + LR_CHARS_TO_PRINT;
 	
-	ii = START;
-	for (int i = 0; i < alignStart - refStart; ++i){ temp += 'x'; }
-	while (ii < alignedSeq.end()) { temp += *(ii++); }
+	PreAlignedPost.clear();
+	PreAlignedPost.reserve(numPre + 2*lead + expanded.length() - START);
+	if (numPre > START) PreAlignedPost.append(numPre - START, 'x');
+	PreAlignedPost.append(expanded, max(0, START - numPre), min(numPre, START));
+	if (posLeft < 0) PreAlignedPost.append(-posLeft, 'x');
+	PreAlignedPost.append(lead, 'x');
+	PreAlignedPost.append(expanded, START, string::npos);
 	
-	return temp; //return modified string
+	return true;
 }
 
-inline void print_output(string region,FastaReference* fr, stringstream &vcf,  stringstream &oFile, stringstream &callsFile, const SETTINGS_FILTERS &settings, BamReader & reader){
+//parse a line of the region file & fetch the reference sequence around it;
+//returns false if the line should be skipped
+bool initLocus(string region, FastaReference* fr, const SETTINGS_FILTERS &settings, LOCUS &locus){
 	
-	vector<string> insertions;
 	string sequence;                // holds reference sequence
 	string secondColumn;            // text string to the right of tab
-	int unitLength;
-	double purity;
 	
 	// parse region argument:
 	secondColumn = region.substr(region.find('\t',0)+1,-1);
@@ -340,15 +418,17 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	// parse secondColumn:
 	if (int(secondColumn.find('_',0)) == -1) {
 		cout << "improper second column found for " << region << ".\ncontinuing with next region..." << endl;
-		return;
+		return false;
 	}
-	unitLength = atoi(secondColumn.substr(0,secondColumn.find('_',0)).c_str());
-	string UnitSeq = secondColumn.substr(secondColumn.rfind('_')+1);	
+	locus.region = region;
+	locus.secondColumn = secondColumn;
+	locus.unitLength = atoi(secondColumn.substr(0,secondColumn.find('_',0)).c_str());
+	locus.UnitSeq = secondColumn.substr(secondColumn.rfind('_')+1);	
 	
 	int pos = 0;
 	for (int i = 0; i < 3; ++i) pos = secondColumn.find('_',pos + 1);
 	++pos; //increment past fourth '_'
-	purity = atof(secondColumn.substr(pos,secondColumn.find('_',pos)).c_str());
+	locus.purity = atof(secondColumn.substr(pos,secondColumn.find('_',pos)).c_str());
 	
 	Region target(region);
 	if (target.startPos > target.stopPos) throw "Invalid input file...";
@@ -400,7 +480,7 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	int firstSpace = sequence.find(' ',0);
 	int secondSpace = sequence.find(' ',firstSpace+1);
 	
-	string leftReference, centerReference, rightReference;
+	string &leftReference = locus.leftReference, &centerReference = locus.centerReference, &rightReference = locus.rightReference;
 	if (firstSpace != 0) leftReference = sequence.substr(0,firstSpace);
 	else leftReference = "";
 	centerReference = sequence.substr(firstSpace+1,secondSpace-firstSpace-1);
@@ -408,235 +488,629 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	else rightReference = "";
 	
 	// ensure reference is all caps (for matching purposes):
-	std::transform(leftReference.begin(), leftReference.end(), leftReference.begin(), ::toupper);	
-	std::transform(centerReference.begin(), centerReference.end(), centerReference.begin(), ::toupper);	
-	std::transform(rightReference.begin(), rightReference.end(), rightReference.begin(), ::toupper);	
+	upperCase(leftReference);
+	upperCase(centerReference);
+	upperCase(rightReference);
+	
+	//the longer flanks -flankerrors compares reads against:
+	if (settings.flankErrors && target.startPos > 0) {
+		int start = target.startPos - 1, end = start + target.length(), size = fr->sequenceLength(target.startSeq);
+		int left = min(settings.flankWindow, start), right = min(settings.flankWindow, size - end);
+		locus.leftFlank = left > 0 ? fr->getSubSequence(target.startSeq, start - left, left) : "";
+		locus.rightFlank = right > 0 ? fr->getSubSequence(target.startSeq, end, right) : "";
+		upperCase(locus.leftFlank);
+		upperCase(locus.rightFlank);
+	}
 	
 	// define our region of interest:
-	// debug-cout << "region: " << target.startSeq << ":" << target.startPos-1 << "-" << target.stopPos-1 << endl;
-	BamRegion bamRegion(reader.GetReferenceID(target.startSeq), target.startPos - 1,reader.GetReferenceID(target.startSeq), target.stopPos - 1);
-	reader.SetRegion(bamRegion);
+	locus.target = target;
+	locus.left = target.startPos - 1;
+	locus.right = target.stopPos - 1;
+	if (settings.realignUnits) buildHaplotypes(locus, fr, settings);
 	
-	// prep for getting alignment info
-	BamAlignment al;
+	return true;
+}
+
+//allele length of a read: the bases of its repeat window plus any inserted right after the repeat
+//(which print_output() moves into the repeat when the reads are expanded for printing)
+int alleleLength(const string &aligned, const string &post){
+	int length = aligned.length() - count(aligned.begin(), aligned.end(), '-');
+	for (string::const_iterator c = post.begin(); c < post.end() && isInsertedBase(*c); ++c) ++length;
+	return length;
+}
+
+//the allele of a read as print_output() leaves it once the reads are expanded: alleleLength()'s
+//bases without deletions, inserted bases shifted back down
+string alleleSequence(const string &aligned, const string &post){
+	string allele;
+	allele.reserve(aligned.length() + 4);
+	for (string::const_iterator c = aligned.begin(); c < aligned.end(); ++c)
+		if (*c != '-') allele += isInsertedBase(*c) ? *c - 1 : *c;
+	for (string::const_iterator c = post.begin(); c < post.end() && isInsertedBase(*c); ++c) allele += *c - 1;
+	return allele;
+}
+
+//print the inserted bases of a read that was never expanded (see parseCigar()) in lower case
+void decodeInsertions(string &seq){
+	for (string::iterator c = seq.begin(); c < seq.end(); ++c)
+		if (isInsertedBase(*c)) *c = tolower(*c - 1);
+}
+
+//add a read to an allele histogram
+void tallyAllele(vector<GT> &alleles, const STRING_GT &read){
+	if (read.GT == 0) return;       //no bases in the repeat
+	vector<GT>::iterator it = alleles.begin();
+	while (it < alleles.end() && it->readlength != read.GT) ++it;
+	if (it == alleles.end()) alleles.push_back(GT(read.GT, 1, read.reverse, read.minFlank, read.avgBQ));
+	else {
+		it->occurrences += 1;
+		it->avgBQ += read.avgBQ;
+		it->avgMinFlank += read.minFlank;
+		if (read.reverse) it->reverse += 1;
+	}
+}
+
+//run a read that overlaps a locus through the filters, collecting it if it passes
+void addRead(const LOCUS &locus, LOCUS_READS &reads, const BamAlignment &al, const PROJECTION &proj, const SETTINGS_FILTERS &settings){
+	const Region &target = locus.target;
+	const string &leftReference = locus.leftReference, &rightReference = locus.rightReference;
+	vector<string> insertions;
 	stringstream ssPrint;                   //where data to print will be stored
 	string PreAlignedPost = "";             //contains all 3 strings to be printed
-	double concordance = 0;
-	int totalOccurrences = 0;
-	int majGT = 0;
-	int occurMajGT = 0;
-	int depth = 0;
-	int numReads = 0;
-	int numStars = 0;
-	
-	vector<GT> vectorGT;
-	vectorGT.reserve(100);
-	vector<STRING_GT> toPrint;
-	toPrint.reserve(100);
-	
-	string vcfPrint;
-	
-	//cout << "trying " << target.startSeq << ":" << target.startPos - 1 << "-" << target.stopPos - 1 << endl;
-	// iterate through alignments in this region,
-	while (reader.GetNextAlignment(al)) {
-		//cout << " found\n";
-		insertions.clear();
-		ssPrint.str("");
-		stringstream cigarSeq;
-		int gtBonus = 0;
+	
+	if (al.CigarData.begin()==al.CigarData.end()) {
+		reads.numStars++;
+		return;
+		//if CIGAR is not there, it's * case..
+		//so increment numStars and get next alignment
+	}
+	
+	//cut this locus out of the parsed read:
+	double avgBQ = proj.avgBQ;
+	if (!projectLocus(proj, target.startPos, settings.LR_CHARS_TO_PRINT, PreAlignedPost, insertions)){ 
+		//If an 'N' or other problem was found
+		cout << "N found-- Possible Error!\n";
+		return; 
+	} 
+	
+	//adjust for d's
+	PreAlignedPost.erase( std::remove(PreAlignedPost.begin(), PreAlignedPost.end(), 'd'), PreAlignedPost.end() );
+	
+	//set strings to print based off of value input
+	string PreSeq, AlignedSeq, PostSeq;
+	
+	//if there's not enough characters to make it through PreSeq, skip read
+	if (PreAlignedPost.length() < settings.LR_CHARS_TO_PRINT+1) return;
+	
+	//Split PreAlignedPost into 3 substrings
+	PreSeq = PreAlignedPost.substr(0,settings.LR_CHARS_TO_PRINT);
+	AlignedSeq = PreAlignedPost.substr(settings.LR_CHARS_TO_PRINT, target.length());
+	if (AlignedSeq.length() < target.length()) AlignedSeq.resize(target.length(),'x');
+	else PostSeq = PreAlignedPost.substr(settings.LR_CHARS_TO_PRINT + target.length(), settings.LR_CHARS_TO_PRINT);
+	PostSeq.resize(settings.LR_CHARS_TO_PRINT,'x');
+	
+	if (AlignedSeq[target.length()/2] != 'x') ++reads.depth;      //increment depth (if middle character is NOT an x)
+	int numMatchesL = 0, numMatchesR = 0;
+	int minflank = 0;
+	// if first and last characters of sequence range are present in read, print it's information:
+	if (isReadBase(AlignedSeq[0])) {
+		if (isReadBase(AlignedSeq[AlignedSeq.length()-1])) {
+			string toprintPre = string(PreSeq);
+			string toprintAligned = string(AlignedSeq);
+			string toprintPost = string(PostSeq);
+			
+			bool hasinsertions = (! insertions.empty());
+			if (hasinsertions){
+				//PROCESS SEQUENCE:
+				//put insertions back in pre-sequence (as lower case) here
+				for (int i = 0; i < toprintPre.length();){
+					if (toprintPre[i] > 96 && toprintPre[i] != 'x'){	//is lowercase
+						toprintPre[i++] -= 32;							//convert to uppercase
+						if (i == toprintPre.length()) toprintAligned = insertions.front() + toprintAligned;
+						else toprintPre.insert(i,insertions.front());
+						insertions.erase(insertions.begin());
+					}
+					else ++i;
+				}
+				//put insertions back in Aligned-sequence (as lower case) here
+				for (int i = 0; i < toprintAligned.length();){
+					if (toprintAligned[i] > 96 && toprintAligned[i] != 'x'){	//is lowercase
+						toprintAligned[i++] -= 32;							//convert to uppercase
+						if (i == toprintAligned.length()) toprintPost = insertions.front() + toprintPost;
+						else toprintAligned.insert(i,insertions.front());
+						insertions.erase(insertions.begin());
+					}
+					else ++i;
+				}
+				//put insertions back in Post-sequence (as lower case) here
+				for (int i = 0; i < toprintPost.length();){
+					if (toprintPost[i] > 96 && toprintPost[i] != 'x'){	//is lowercase
+						toprintPost[i++] -= 32;							//convert to uppercase
+						if (i == toprintPost.length()) toprintPost += insertions.front();
+						else toprintPost.insert(i,insertions.front());
+						insertions.erase(insertions.begin());
+					}
+					else ++i;
+				}
+			}
+			
+			ssPrint << " " << (al.Position + 1) << " ";   //start position
+			
+			//Determine & print read size information:
+			int readSize = proj.readSize;
+			ssPrint << readSize << " ";      //read size
+			
+			//FILTER based on min/max read length restrictions:
+			if (settings.readLengthMin && readSize < settings.readLengthMin){ return; }
+			if (settings.readLengthMax && readSize > settings.readLengthMax){ return; }
 		
-		if (al.CigarData.begin()==al.CigarData.end()) {
-			numStars++;
+			//Determine consecutive matching flanking bases (LEFT & RIGHT), as far as the reference goes:
+			size_t flankL = min(PreSeq.length(), leftReference.length()), flankR = min(PostSeq.length(), rightReference.length());
+			numMatchesL = flankMatchesFromEnd(PreSeq.data() + PreSeq.length() - flankL, leftReference.data() + leftReference.length() - flankL, flankL);
+			numMatchesR = flankMatches(PostSeq.data(), rightReference.data(), flankR);
+			
+			// Set minflank & print matching # of consecutive bases to the left/right of repeat
+			if (numMatchesR < minflank) minflank = numMatchesR;
+			else { minflank = numMatchesL; }
+			ssPrint << numMatchesL << " " << numMatchesR << " ";  
+			
+			//FILTER based on consecutive flank bases (or, with -flankerrors, the flank's edit distance)
+			if (numMatchesL < settings.consLeftFlank && !(settings.flankErrors && flankDistance(proj, locus, true, settings.consLeftFlank) <= settings.flankErrors)) return;
+			if (numMatchesR < settings.consRightFlank && !(settings.flankErrors && flankDistance(proj, locus, false, settings.consRightFlank) <= settings.flankErrors)) return;
+			
+			//Print avgBQ:
+			ssPrint << "B:" << float(int(10000*avgBQ))/10000 << " ";
+
+			//FILTER based on MapQ, then print MapQ
+			if (al.MapQuality < settings.MapQuality) return;  //MapQuality Filter
+			ssPrint << "M:" << al.MapQuality << " ";
+			
+			//PRINT FLAG STRING:
+			ssPrint << "F:";
+			if (al.IsPaired()) ssPrint << 'p';
+			if (al.IsProperPair()) ssPrint << 'P';
+			if (!al.IsMapped()) ssPrint << 'u';
+			if (!al.IsMateMapped()) ssPrint << 'U';
+			if (al.IsReverseStrand()) ssPrint << 'r';
+			if (al.IsMateReverseStrand()) ssPrint << 'R';
+			if (al.IsFirstMate()) ssPrint << '1';
+			if (al.IsSecondMate()) ssPrint << '2';
+			if (!al.IsPrimaryAlignment()) ssPrint << 's';
+			if (al.IsFailedQC()) ssPrint << 'f';
+			if (al.IsDuplicate()) ssPrint << 'd';
+			
+			//print CIGAR string:
+			ssPrint << " C:";
+			for (vector<BamTools::CigarOp>::const_iterator it=al.CigarData.begin(); it < al.CigarData.end(); it++) {
+				ssPrint << it->Length;
+				ssPrint << it->Type;
+			}
+			
+			//-MULTI filter (check for XT:A:R tag):
+			string stringXT;
+			al.GetTag("XT",stringXT);
+			if (settings.multi && stringXT.find('R',0) != -1) return;  //if stringXT contains R, ignore read
+			
+			//-PP filter (check if read is properly paired):
+			if (settings.properlyPaired && !al.IsProperPair()){ return; }
+			
+			ssPrint << " ID:" << al.Name << endl;
+			
+			//with -realign, the allele of a read realigned unambiguously to a candidate replaces the CIGAR's
+			string realigned;
+			int length = settings.realignUnits ? realignRead(locus, al, proj, settings, reads.realignWork, realigned) : -1;
+			if (length < 0) length = alleleLength(toprintAligned, toprintPost);
+			
+			reads.toPrint.push_back( STRING_GT(ssPrint.str(), Sequences(toprintPre, toprintAligned, toprintPost, hasinsertions), length, al.IsProperPair(), al.MapQuality, minflank, al.IsReverseStrand(), avgBQ) );
+			reads.toPrint.back().realigned = realigned;
+			if (settings.pileup) {
+				PILEUP_READ &fields = reads.toPrint.back().pileup;
+				fields.position = al.Position + 1;
+				fields.readSize = readSize;
+				fields.flankLeft = numMatchesL;
+				fields.flankRight = numMatchesR;
+				fields.baseQuality = int(10000*avgBQ);
+				fields.flags = pileupFlags(al);
+				fields.cigar = al.CigarData;
+				fields.name = al.Name;
+			}
+			//with -families, the histogram & sequences are of the families (see collapseFamilies())
+			if (settings.families) reads.toPrint.back().family = familyKey(al, settings);
+			else {
+				reads.sequences.add(realigned.empty() ? alleleSequence(toprintAligned, toprintPost) : realigned);
+				tallyAllele(reads.alleles, reads.toPrint.back());
+			}
+		}
+	}        //end if statements
+}
+
+//hand a read to every locus of loci[done..] it overlaps, reads[i] collecting for loci[i]
+inline void dispatchRead(const BamAlignment &al, const vector<LOCUS> &loci, size_t done, LOCUS_READS *reads, PROJECTION &proj, const SETTINGS_FILTERS &settings){
+	bool parsed = false;
+	PERF_MARK mark;
+	int reach;
+	if (settings.longReads && al.CigarData.begin()!=al.CigarData.end()) {
+		//index the CIGAR once; each locus then walks only its window (see longreads.cpp)
+		perfBegin(STAGE_PARSECIGAR, mark);
+		indexCigar(al, proj);
+		perfEnd(mark);
+		reach = max(al.Position, proj.alignEnd);
+	}
+	else reach = max(al.Position, al.GetEndPosition());
+	for (size_t i = done; i < loci.size() && loci[i].left <= reach; ++i) {
+		if (reads[i].truncated) continue;
+		if (settings.longReads && al.CigarData.begin()!=al.CigarData.end()) {
+			if (al.Position >= loci[i].right || (al.Position < loci[i].left && reach <= loci[i].left)) continue;
+		}
+		else if (!overlapsLocus(al, loci[i])) continue;
+		if ((settings.budget || settings.captureSeconds) && !reads[i].started) reads[i].started = wallTime();
+		if (settings.qc) {
+			qcRead(loci[i], reads[i], al, settings);
 			continue;
-			//if CIGAR is not there, it's * case..
-			//so increment numStars and get next alignment
 		}
-		
-		//load cigarSeq
-		for ( vector<BamTools::CigarOp>::const_iterator it=al.CigarData.begin(); it < al.CigarData.end(); it++ ) {
-			cigarSeq << it->Length;
-			cigarSeq << it->Type;
+		if (settings.longReads && al.CigarData.begin()!=al.CigarData.end()) {
+			int LR = max(settings.LR_CHARS_TO_PRINT, settings.flankErrors ? settings.flankWindow : 0) + LONG_READ_PAD;
+			perfBegin(STAGE_PARSECIGAR, mark);
+			windowCigar(al, proj, loci[i].left - LR, loci[i].right + 1 + LR);
+			perfEnd(mark);
 		}
-		
-		//run parseCigar:
-		double avgBQ;
-		PreAlignedPost = parseCigar(cigarSeq, al.QueryBases, al.Qualities, insertions, al.Position + 1, target.startPos, settings.LR_CHARS_TO_PRINT, avgBQ);
-		if (PreAlignedPost == ""){ 
-			//If an 'N' or other problem was found
-			cout << "N found-- Possible Error!\n";
-			continue; 
-		} 
-		
-		//adjust for d's
-		for (int a = PreAlignedPost.find('d',0); a!=-1; a=PreAlignedPost.find('d',0)) {
-			if ( (a + 1) > settings.LR_CHARS_TO_PRINT && (a + 1) < settings.LR_CHARS_TO_PRINT + target.length()) gtBonus+=1;
-			PreAlignedPost.erase(a,1);
+		else if (!parsed && al.CigarData.begin()!=al.CigarData.end()) {
+			perfBegin(STAGE_PARSECIGAR, mark);
+			parseCigar(al, proj);
+			perfEnd(mark);
+			parsed = true;
 		}
+#ifdef ALLOC_PROFILE
+		double adding = wallTime();
+		uint64_t allocations, allocBytes;
+		allocSnapshot(allocations, allocBytes);
+#endif
+		perfBegin(STAGE_ADDREAD, mark);
+		addRead(loci[i], reads[i], al, proj, settings);
+		perfEnd(mark);
+#ifdef ALLOC_PROFILE
+		reads[i].seconds += wallTime() - adding;
+		reads[i].allocations -= allocations;
+		reads[i].allocBytes -= allocBytes;
+		allocSnapshot(allocations, allocBytes);
+		reads[i].allocations += allocations;
+		reads[i].allocBytes += allocBytes;
+#endif
+	}
+}
+
+
+//a share of one batch of the reads of a deep run of loci:
+typedef struct batch_data {
+    const vector<BamAlignment> * batch;
+    size_t read_start, read_stop;
+    const vector<LOCUS> * loci;
+    size_t done;
+    vector<LOCUS_READS> reads;
+    const SETTINGS_FILTERS * settings;
+    struct batch_helpers * helpers;
+    pthread_t thread;
+    unsigned batchSeen;                     // number of the last batch the helper read its share of
+    double busy;                            // seconds spent on the share
+    string traceName;                       // name of a helper thread in the trace ("" if read inline)
+} batch_data_t;
+
+//the helper threads of a deep run, each started on an idle worker it claimed; they live until the
+//run is read & take a share of every batch
+typedef struct batch_helpers {
+    vector<batch_data_t *> shares;          // shares[0] is read by the worker itself
+    pthread_mutex_t lock;
+    pthread_cond_t start, finished;         // a batch is ready / the helpers have read it
+    unsigned batch;                         // number of the current batch
+    size_t pending;                         // helpers still reading their shares of it
+    bool quit;
+} batch_helpers_t;
+
+//take up to wanted of the idle workers (given back by stopHelpers())
+int claimWorkers(int wanted){
+    for (;;) {
+        int idle = __sync_fetch_and_add(&idleWorkers, 0), taken = min(idle, wanted);
+        if (taken <= 0) return 0;
+        if (__sync_bool_compare_and_swap(&idleWorkers, idle, idle - taken)) return taken;
+    }
+}
+
+//read a share of a batch
+void readShare(batch_data_t &data) {
+    PROJECTION proj;
+    double started = wallTime();
+    for(size_t r = data.read_start; r != data.read_stop; r++)
+        dispatchRead((*data.batch)[r], *data.loci, data.done, &data.reads[0], proj, *data.settings);
+    data.busy = wallTime() - started;
+    traceEvent("batch share", started, "", started + data.busy);
+}
+
+void * batch_thread(void * pdata) {
+    batch_data_t & data = *((batch_data_t *) pdata);
+    batch_helpers_t & helpers = *data.helpers;
+    traceThread(data.traceName);
+    perfThread();
+    
+    pthread_mutex_lock(&helpers.lock);
+    for (;;) {
+        while (!helpers.quit && helpers.batch == data.batchSeen) pthread_cond_wait(&helpers.start, &helpers.lock);
+        if (helpers.quit) break;
+        data.batchSeen = helpers.batch;
+        pthread_mutex_unlock(&helpers.lock);
+        readShare(data);
+        pthread_mutex_lock(&helpers.lock);
+        if (--helpers.pending == 0) pthread_cond_signal(&helpers.finished);
+    }
+    pthread_mutex_unlock(&helpers.lock);
+    
+    perfThreadDone();
+    return NULL;
+}
+
+void startHelpers(batch_helpers_t &helpers){
+    helpers.shares.assign(1, new batch_data_t());
+    pthread_mutex_init(&helpers.lock, NULL);
+    pthread_cond_init(&helpers.start, NULL);
+    pthread_cond_init(&helpers.finished, NULL);
+    helpers.batch = 0;
+    helpers.pending = 0;
+    helpers.quit = false;
+}
+
+//end the helper threads of a run, giving their workers back
+void stopHelpers(batch_helpers_t &helpers){
+    pthread_mutex_lock(&helpers.lock);
+    helpers.quit = true;
+    pthread_cond_broadcast(&helpers.start);
+    pthread_mutex_unlock(&helpers.lock);
+    for (size_t thread = 1; thread < helpers.shares.size(); ++thread)
+        if (0 != pthread_join(helpers.shares[thread]->thread, NULL)) perror("Error closing batch thread");
+    if (helpers.shares.size() > 1) __sync_fetch_and_add(&idleWorkers, int(helpers.shares.size()) - 1);
+    for (size_t thread = 0; thread < helpers.shares.size(); ++thread) delete helpers.shares[thread];
+    helpers.shares.clear();
+    pthread_cond_destroy(&helpers.start);
+    pthread_cond_destroy(&helpers.finished);
+    pthread_mutex_destroy(&helpers.lock);
+}
+
+//split the first batchSize reads of a batch between this thread & its helpers (adding a helper
+//for each worker gone idle since the last batch), merging what they collect in order
+void collectBatch(const vector<BamAlignment> &batch, size_t batchSize, const vector<LOCUS> &loci, size_t done, vector<LOCUS_READS> &reads, worker_data_t &worker, batch_helpers_t &helpers){
+    const SETTINGS_FILTERS &settings = worker.settings;
+    double collecting = wallTime();
+    vector<batch_data_t *> &shares = helpers.shares;
+    
+    //start helpers on the workers gone idle (a worker is given back if its thread can't be started)
+    for (int claimed = claimWorkers(int(batchSize) - int(shares.size())); claimed > 0; --claimed) {
+        batch_data_t *data = new batch_data_t();
+        data->helpers = &helpers;
+        data->batchSeen = helpers.batch;
+        stringstream name;
+        name << "worker " << worker.id << " helper " << shares.size();
+        data->traceName = name.str();
+        if (0 != pthread_create(&data->thread, NULL, batch_thread, data)) {
+            delete data;
+            __sync_fetch_and_add(&idleWorkers, claimed);
+            break;
+        }
+        shares.push_back(data);
+    }
+    
+    size_t num_threads = shares.size();
+    for(size_t thread = 0; thread != num_threads; thread++) {
+        batch_data_t & data = *shares[thread];
+        data.batch = &batch;
+        data.read_start = thread * (batchSize / num_threads);
+        data.read_stop = (thread == num_threads - 1) ? batchSize : (thread+1) * (batchSize / num_threads);
+        data.loci = &loci;
+        data.done = done;
+        data.reads.assign(loci.size(), LOCUS_READS());
+        data.settings = &settings;
+        data.busy = 0;
+        for (size_t i = done; i < loci.size(); ++i) data.reads[i].truncated = reads[i].truncated;
+    }
+    
+    pthread_mutex_lock(&helpers.lock);
+    ++helpers.batch;
+    helpers.pending = num_threads - 1;
+    pthread_cond_broadcast(&helpers.start);
+    pthread_mutex_unlock(&helpers.lock);
+    readShare(*shares[0]);
+    
+    double waiting = wallTime();
+    pthread_mutex_lock(&helpers.lock);
+    while (helpers.pending) pthread_cond_wait(&helpers.finished, &helpers.lock);
+    pthread_mutex_unlock(&helpers.lock);
+    worker.waitTime += wallTime() - waiting;
+    
+    for(size_t thread = 1; thread < num_threads; thread++) worker.helperTime += shares[thread]->busy;
+    for(size_t thread = 0; thread != num_threads; thread++)
+        for (size_t i = done; i < loci.size(); ++i) reads[i].merge(shares[thread]->reads[i]);
+    
+    stringstream detail;
+    detail << batchSize << " reads, " << num_threads << " threads";
+    traceEvent("collectBatch", collecting, detail.str());
+}
+
+//reads taking longer than this (seconds) to arrive from the BAM file are traced as stalls:
+#define TRACE_STALL 0.001
+
+//columns x rows the expansion of print_output() inserts per second, to bound it by the time budget:
+#define EXPAND_WORK_PER_SECOND 20000000
+
+//the time budget is checked this many times over the budget of a locus (on the clock read for each read):
+#define BUDGET_CHECKS 32
+
+//stop collecting reads for loci that are over the time budget; returns true when none of
+//reads[done..] will take further reads
+bool enforceBudget(vector<LOCUS_READS> &reads, size_t done, const SETTINGS_FILTERS &settings){
+	double now = wallTime();
+	bool open = false;
+	for (size_t i = done; i < reads.size(); ++i) {
+		if (reads[i].started && now - reads[i].started > settings.budget) reads[i].truncated = true;
+		if (!reads[i].truncated) open = true;
+	}
+	return !open;
+}
+
+//stream the reads of a run of neighbouring loci past them, parsing each read only once
+void scanLoci(const vector<LOCUS> &loci, worker_data_t &worker){
+	const SETTINGS_FILTERS &settings = worker.settings;
+	BamReader &reader = worker.reader;
+	vector<LOCUS_READS> reads(loci.size());
+	size_t done = 0;        //loci before this have been printed
+	int scanRight = 0;
+	bool traced = false;    //the run holds a sampled locus
+	double scanning = wallTime();
+	for (vector<LOCUS>::const_iterator it = loci.begin(); it < loci.end(); ++it) {
+		scanRight = max(scanRight, it->right);
+		if (traceLocus(it->line)) traced = true;
+	}
+	
+	int refID = reader.GetReferenceID(loci.front().target.startSeq);
+	if (refID >= 0) {
+		double io = wallTime();
+		BamRegion bamRegion(refID, loci.front().left, refID, scanRight);
+		reader.SetRegion(bamRegion);
+		if (traced) traceEvent("SetRegion", io);
 		
-		//set strings to print based off of value input
-		string PreSeq, AlignedSeq, PostSeq;
-		
-		//if there's not enough characters to make it through PreSeq, skip read
-		if (PreAlignedPost.length() < settings.LR_CHARS_TO_PRINT+1) continue;
-		
-		//Split PreAlignedPost into 3 substrings
-		PreSeq = PreAlignedPost.substr(0,settings.LR_CHARS_TO_PRINT);
-		AlignedSeq = PreAlignedPost.substr(settings.LR_CHARS_TO_PRINT, target.length());
-		if (AlignedSeq.length() < target.length()) AlignedSeq.resize(target.length(),'x');
-		else PostSeq = PreAlignedPost.substr(settings.LR_CHARS_TO_PRINT + target.length(), settings.LR_CHARS_TO_PRINT);
-		PostSeq.resize(settings.LR_CHARS_TO_PRINT,'x');
+		//runs holding a deep locus (estimated at -deep reads or more) are read in batches, each shared among idle threads
+		bool deep = false;
+		for (vector<LOCUS>::const_iterator it = loci.begin(); worker.index && it < loci.end() && !deep; ++it)
+			deep = worker.index->estimateReads(refID, it->left, it->right, settings.MAX_READ_SIZE) >= settings.deepReads;
+		vector<BamAlignment> batch(deep ? DEEP_BATCH_SIZE : 1);
+		size_t batchSize = 0;
+		double budgetCheck = 0;         //when the budget is next checked
+		PROJECTION proj;
+		batch_helpers_t helpers;
+		if (deep) startHelpers(helpers);
 		
-		if (AlignedSeq[target.length()/2] != 'x') ++depth;      //increment depth (if middle character is NOT an x)
-		int numMatchesL = 0, numMatchesR = 0;
-		int minflank = 0;
-
-		// if first and last characters of sequence range are present in read, print it's information:
-		if (AlignedSeq[0] != ' ' && AlignedSeq[0] != 'x' && AlignedSeq[0] != 'X' && AlignedSeq[0] != 'S') {
-			if (AlignedSeq[AlignedSeq.length()-1]!= 'x' && AlignedSeq[AlignedSeq.length()-1]!= ' ' && AlignedSeq[AlignedSeq.length()-1]!='X' && AlignedSeq[AlignedSeq.length()-1] != 'S') {
-				string toprintPre = string(PreSeq);
-				string toprintAligned = string(AlignedSeq);
-				string toprintPost = string(PostSeq);
-				
-				bool hasinsertions = (! insertions.empty());
-				if (hasinsertions){
-					//PROCESS SEQUENCE:
-					//put insertions back in pre-sequence (as lower case) here
-					for (int i = 0; i < toprintPre.length();){
-						if (toprintPre[i] > 96 && toprintPre[i] != 'x'){	//is lowercase
-							toprintPre[i++] -= 32;							//convert to uppercase
-							if (i == toprintPre.length()) toprintAligned = insertions.front() + toprintAligned;
-							else toprintPre.insert(i,insertions.front());
-							insertions.erase(insertions.begin());
-						}
-						else ++i;
-					}
-					//put insertions back in Aligned-sequence (as lower case) here
-					for (int i = 0; i < toprintAligned.length();){
-						if (toprintAligned[i] > 96 && toprintAligned[i] != 'x'){	//is lowercase
-							toprintAligned[i++] -= 32;							//convert to uppercase
-							if (i == toprintAligned.length()) toprintPost = insertions.front() + toprintPost;
-							else toprintAligned.insert(i,insertions.front());
-							insertions.erase(insertions.begin());
-						}
-						else ++i;
-					}
-					//put insertions back in Post-sequence (as lower case) here
-					for (int i = 0; i < toprintPost.length();){
-						if (toprintPost[i] > 96 && toprintPost[i] != 'x'){	//is lowercase
-							toprintPost[i++] -= 32;							//convert to uppercase
-							if (i == toprintPost.length()) toprintPost += insertions.front();
-							else toprintPost.insert(i,insertions.front());
-							insertions.erase(insertions.begin());
-						}
-						else ++i;
-					}
-				}
-				
-				ssPrint << " " << (al.Position + 1) << " ";   //start position
-				
-				//Determine & print read size information:
-				int readSize = 0;
-				for (vector<BamTools::CigarOp>::const_iterator it=al.CigarData.begin(); it < al.CigarData.end(); it++){
-					if (it->Type == 'M' || it->Type == 'I' || it->Type == 'S' || it->Type == '=' || it->Type == 'X'){
-						readSize += it->Length;         //increment readsize by the length
-					}
-				}
-				ssPrint << readSize << " ";      //read size
-				
-				//FILTER based on min/max read length restrictions:
-				if (settings.readLengthMin && readSize < settings.readLengthMin){ continue; }
-				if (settings.readLengthMax && readSize > settings.readLengthMax){ continue; }
+		//with -qc, only the core fields are decoded (the tags too for -multi)
+		while (settings.qc ? reader.GetNextAlignmentCore(batch[batchSize]) && (!settings.multi || batch[batchSize].BuildCharData()) : reader.GetNextAlignment(batch[batchSize])) {
+			double read = wallTime();
+			worker.ioTime += read - io;
+			if (read - io > TRACE_STALL) traceEvent("BAM read stall", io, "", read);
+			readDone(worker, batch[batchSize]);
 			
-				//Determine consecutive matching flanking bases (LEFT):
-				string::iterator i = PreSeq.end()-1;
-				string::iterator i2 = leftReference.end()-1;
-				bool consStreak = 1;
-				numMatchesL = 0;
-				for (int ctr = 0; ctr < PreSeq.length(); ++ctr ) {      //-1 compensates for matching null character @ end of all strings
-					if ((*i != *i2) && (*i != *i2 + 32)) {
-						consStreak = 0;
-						if (ctr < 3){
-							if (*i == 'x' || *i == 'S' || (*i2 != '-' && *i == '-') || (*i2 == '-' && *i != '-' )){ 
-								continue; //fail the read
-							}
-						}
-					}
-					else if (consStreak){ ++numMatchesL;}
-					--i; --i2;
+			//reads arrive sorted, so loci ending before this read are complete
+			if (done < loci.size() && loci[done].right <= batch[batchSize].Position) {
+				if (batchSize) {
+					//collect the batch so far, moving this read to the start of the next one
+					collectBatch(batch, batchSize, loci, done, reads, worker, helpers);
+					swap(batch[0], batch[batchSize]);
+					batchSize = 0;
 				}
-				
-				//Determine consecutive matching flanking bases (RIGHT):
-				i = PostSeq.begin();
-				i2 = rightReference.begin();
-				consStreak = 1; 
-				numMatchesR = 0;
-				for (int ctr = 0; ctr < PostSeq.length(); ctr++) { 
-					if ((*i != *i2) && (*i != *i2 + 32)){
-						consStreak = 0;
-						if (ctr < 3){ 
-							if (*i == 'x' || *i == 'S' || (*i2 != '-' && *i == '-') || (*i2 == '-' && *i != '-' )){
-								continue; //fail the read
-							}
-						}
-					}
-					else{
-						if (consStreak) ++numMatchesR;
-					}
-					++i; ++i2;
+				while (done < loci.size() && loci[done].right <= batch[0].Position) {
+					if (settings.qc) qcLocus(loci[done], reads[done], worker.qcFile, worker.qcTotals);
+					else print_output(loci[done], reads[done], worker.vcfFile, worker.oFile, worker.callsFile, worker.columns, worker.pileup, worker.outputIndex, worker.gvcfBlock, worker.summary, settings);
+					captureLocus(worker, loci[done], reads[done].started);
+					regionDone(worker, loci[done].line);
+					reads[done++] = LOCUS_READS();
 				}
-				
-				// Set minflank & print matching # of consecutive bases to the left/right of repeat
-				if (numMatchesR < minflank) minflank = numMatchesR;
-				else { minflank = numMatchesL; }
-				ssPrint << numMatchesL << " " << numMatchesR << " ";  
-				
-				//FILTER based on consecutive flank bases
-				if (numMatchesL < settings.consLeftFlank) continue;
-				if (numMatchesR < settings.consRightFlank) continue;
-				
-				//Print avgBQ:
-				ssPrint << "B:" << float(int(10000*avgBQ))/10000 << " ";
+			}
+			
+			if (!deep) dispatchRead(batch[0], loci, done, &reads[0], proj, settings);
+			else if (++batchSize == batch.size()) {
+				collectBatch(batch, batchSize, loci, done, reads, worker, helpers);
+				batchSize = 0;
+			}
+			
+			//stop reading once every locus left is over its budget
+			if (settings.budget && read >= budgetCheck) {
+				if (enforceBudget(reads, done, settings)) break;
+				budgetCheck = read + settings.budget / BUDGET_CHECKS;
+			}
+			io = wallTime();
+		}
+		worker.ioTime += wallTime() - io;
+		if (batchSize) collectBatch(batch, batchSize, loci, done, reads, worker, helpers);
+		if (deep) stopHelpers(helpers);
+	}
+	
+	for (; done < loci.size(); ++done) {
+		if (settings.qc) qcLocus(loci[done], reads[done], worker.qcFile, worker.qcTotals);
+		else print_output(loci[done], reads[done], worker.vcfFile, worker.oFile, worker.callsFile, worker.columns, worker.pileup, worker.outputIndex, worker.gvcfBlock, worker.summary, settings);
+		captureLocus(worker, loci[done], reads[done].started);
+		regionDone(worker, loci[done].line);
+		reads[done] = LOCUS_READS();
+	}
+	
+	if (traced) {
+		stringstream detail;
+		detail << loci.front().region << " (" << loci.size() << " loci)";
+		traceEvent("scanLoci", scanning, detail.str());
+	}
+}
 
-				//FILTER based on MapQ, then print MapQ
-				if (al.MapQuality < settings.MapQuality) continue;  //MapQuality Filter
-				ssPrint << "M:" << al.MapQuality << " ";
-				
-				//PRINT FLAG STRING:
-				ssPrint << "F:";
-				if (al.IsPaired()) ssPrint << 'p';
-				if (al.IsProperPair()) ssPrint << 'P';
-				if (!al.IsMapped()) ssPrint << 'u';
-				if (!al.IsMateMapped()) ssPrint << 'U';
-				if (al.IsReverseStrand()) ssPrint << 'r';
-				if (al.IsMateReverseStrand()) ssPrint << 'R';
-				if (al.IsFirstMate()) ssPrint << '1';
-				if (al.IsSecondMate()) ssPrint << '2';
-				if (!al.IsPrimaryAlignment()) ssPrint << 's';
-				if (al.IsFailedQC()) ssPrint << 'f';
-				if (al.IsDuplicate()) ssPrint << 'd';
-				
-				//print CIGAR string:
-				ssPrint << " C:";
-				for (vector<BamTools::CigarOp>::const_iterator it=al.CigarData.begin(); it < al.CigarData.end(); it++) {
-					ssPrint << it->Length;
-					ssPrint << it->Type;
-				}
-				
-				//-MULTI filter (check for XT:A:R tag):
-				string stringXT;
-				al.GetTag("XT",stringXT);
-				if (settings.multi && stringXT.find('R',0) != -1) continue;  //if stringXT contains R, ignore read
-				
-				//-PP filter (check if read is properly paired):
-				if (settings.properlyPaired && !al.IsProperPair()){ continue; }
-				
-				ssPrint << " ID:" << al.Name << endl;
-				
-				toPrint.push_back( STRING_GT(ssPrint.str(), Sequences(toprintPre, toprintAligned, toprintPost, hasinsertions), AlignedSeq.length() + gtBonus, al.IsProperPair(), al.MapQuality, minflank, al.IsReverseStrand(), avgBQ) );
+//group the regions of a worker into runs of loci on the same chromosome lying within a read
+//length of one another; each run is fetched from the BAM file with a single SetRegion() 
+void scanRegions(worker_data_t &worker){
+	const SETTINGS_FILTERS &settings = worker.settings;
+	vector<string>::const_iterator first = worker.regions.begin() + worker.region_start;
+	vector<string>::const_iterator last = worker.regions.begin() + worker.region_stop;
+	vector<LOCUS> loci;
+	LOCUS locus;
+	bool pending = false;   //locus holds the first locus of the next run
+	
+	while (pending || first != last) {
+		loci.clear();
+		int scanRight = 0;
+		if (pending) {
+			loci.push_back(locus);
+			scanRight = locus.right;
+			pending = false;
+		}
+		
+		while (first != last) {
+			size_t line = first - worker.regions.begin();
+			if (!initLocus(*(first++), worker.fr, settings, locus)) {
+				regionDone(worker, line);
+				continue;
 			}
-		}        //end if statements
+			locus.line = line;
+			if (!loci.empty() && (locus.target.startSeq != loci.back().target.startSeq || locus.left < loci.back().left || locus.left > scanRight + settings.MAX_READ_SIZE)) {
+				pending = true;
+				break;
+			}
+			loci.push_back(locus);
+			scanRight = max(scanRight, locus.right);
+		}
 		
-	} //end while loop
+		if (!loci.empty()) scanLoci(loci, worker);
+	}
+}
+
+//print the genotype & reads collected for a locus to the output files
+void print_output(const LOCUS &locus, LOCUS_READS &reads, stringstream &vcf,  stringstream &oFile, stringstream &callsFile, RESULT_COLUMNS &columns, PILEUP_WRITER &pileup, vector<OUTPUT_RECORD> &outputIndex, GVCF_BLOCK &gvcfBlock, SUMMARY_TABLE &summary, const SETTINGS_FILTERS &settings){
+	
+	const string &region = locus.region, &secondColumn = locus.secondColumn, &UnitSeq = locus.UnitSeq;
+	int unitLength = locus.unitLength;
+	double purity = locus.purity;
+	const Region &target = locus.target;
+	const string &leftReference = locus.leftReference, &centerReference = locus.centerReference, &rightReference = locus.rightReference;
+	vector<STRING_GT> &toPrint = reads.toPrint;
+	bool traced = traceLocus(locus.line);
+	double printing = wallTime();
+	PERF_MARK printMark, stageMark;
+	perfBegin(STAGE_PRINT, printMark);
+	perfBegin(STAGE_EXPAND, stageMark);
+#ifdef ALLOC_PROFILE
+	uint64_t allocations, allocBytes;
+	allocSnapshot(allocations, allocBytes);
+	reads.allocations -= allocations;
+	reads.allocBytes -= allocBytes;
+#endif
+	
+	double concordance = 0;
+	int totalOccurrences = 0;
+	int majGT = 0;
+	int occurMajGT = 0;
+	int depth = reads.depth;
+	int numReads = 0;
+	int numStars = reads.numStars;
+	
+	if (settings.families) collapseFamilies(reads);
+	vector<GT> vectorGT = reads.alleles;
 	
 	numReads = toPrint.size();
 	
@@ -648,7 +1122,33 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	for (vector<STRING_GT>::iterator it=toPrint.begin(); it < toPrint.end(); it++){
 		if (it->reads.insertions) skip = 0;
 	}
-	if (true){
+	
+	// a locus over its time budget is left unexpanded (allele lengths don't depend on it); the
+	// expansion inserts a column into every row for each inserted base, so its work is bounded up
+	// front (rows x inserted bases) against what is left of the budget & a locus is never left
+	// half expanded:
+	bool timedOut = reads.truncated;
+	if (settings.budget && reads.started && !timedOut){
+		double inserted = 0;
+		for (vector<STRING_GT>::const_iterator jt=toPrint.begin(); jt < toPrint.end(); jt++){
+			inserted += count_if(jt->reads.preSeq.begin(), jt->reads.preSeq.end(), isInsertedBase);
+			inserted += count_if(jt->reads.alignedSeq.begin(), jt->reads.alignedSeq.end(), isInsertedBase);
+			inserted += count_if(jt->reads.postSeq.begin(), jt->reads.postSeq.end(), isInsertedBase);
+		}
+		double left = reads.started + settings.budget - wallTime();
+		timedOut = left <= 0 || toPrint.size() * inserted > left * EXPAND_WORK_PER_SECOND;
+	}
+	string timedOutAllele;
+	if (timedOut){
+		// keep the first read's allele for the VCF, then print inserted bases in lower case
+		if (toPrint.size() > 1) timedOutAllele = alleleSequence(toPrint[1].reads.alignedSeq, toPrint[1].reads.postSeq);
+		for (vector<STRING_GT>::iterator jt=toPrint.begin(); jt < toPrint.end(); jt++){
+			decodeInsertions(jt->reads.preSeq);
+			decodeInsertions(jt->reads.alignedSeq);
+			decodeInsertions(jt->reads.postSeq);
+		}
+	}
+	else {
 		//Handle PRE-SEQ:
 		for (int index = 0, limit = settings.LR_CHARS_TO_PRINT + 1; index < limit; ++index){
 			for (vector<STRING_GT>::iterator jt=toPrint.begin(); jt < toPrint.end(); jt++){
@@ -728,44 +1228,12 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 		for (vector<STRING_GT>::iterator jt=toPrint.begin(); jt < toPrint.end(); jt++){
 			jt->reads.alignedSeq += jt->reads.postSeq.substr(0, index);
 			jt->reads.postSeq.erase(0,index);
-			
-			if (jt->GT){ //if it's not the reference..
-				string repeat = jt->reads.alignedSeq;
-				repeat.erase(std::remove (repeat.begin(), repeat.end(), '-'), repeat.end());
-				
-				jt->GT = repeat.length();
-			}
 		}
 	}
+	if (traced) traceEvent("expand", printing, region);
+	perfEnd(stageMark);
 
 	
-	// Build VectorGT from toPrint:
-	for (vector<STRING_GT>::iterator tP=toPrint.begin(); tP < toPrint.end(); ++tP) {
-		if (tP->GT == 0) continue; //ignore reference
-		if (!vectorGT.empty()) {
-			for (vector<GT>::iterator it = vectorGT.begin(); 1; ) {
-				if (it->readlength == tP->GT) {
-					it->occurrences += 1;
-					it->avgBQ += tP->avgBQ;
-					it->avgMinFlank += tP->minFlank;
-					if (tP->reverse) it->reverse += 1;
-					break;
-				}
-				else {
-					++it;
-					if (it == vectorGT.end()) {
-						GT a(tP->GT, 1, tP->reverse, tP->minFlank, tP->avgBQ);
-						vectorGT.insert(vectorGT.end(), a);
-						break;
-					}
-				}
-			}
-		}
-		else {
-			GT a(tP->GT, 1, tP->reverse, tP->minFlank, tP->avgBQ);
-			vectorGT.insert(vectorGT.end(), a);
-		}
-	}
 	//average out BQs & flanks
 	for (vector<GT>::iterator it = vectorGT.begin(); it < vectorGT.end(); ++it) {
 		it->avgBQ /= it->occurrences;
@@ -786,13 +1254,14 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	//sort vectorGT by occurrences..
 	sort(vectorGT.begin(), vectorGT.end(), vectorGTsort);
 	
-	//output header line
-	oFile << "~" << region << " ";
-	oFile << secondColumn;
-	oFile << " REF:" << target.length();
-	oFile << " A:";
+	//output header line (kept for -pileup)
+	stringstream header;
+	header << "~" << region << " ";
+	header << secondColumn;
+	header << " REF:" << target.length();
+	header << " A:";
 	if (!vectorGT.size()) {
-		oFile << "NA ";
+		header << "NA ";
 		concordance = -1;
 		majGT = -1;
 	}
@@ -801,19 +1270,19 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 			if (numReads == 1) {
 				concordance = -1;
 				majGT = vectorGT.begin()->readlength;
-				oFile << "NA ";
+				header << "NA ";
 			}
 			else {
 				concordance = 1;
 				majGT = vectorGT.begin()->readlength;
-				oFile << vectorGT.begin()->readlength << " ";
-				//oFile << "(" << vectorGT.begin()->avgBQ << ")"; //temp
+				header << vectorGT.begin()->readlength << " ";
+				//header << "(" << vectorGT.begin()->avgBQ << ")"; //temp
 			}
 		}
 		else {
 			for (vector<GT>::iterator it=vectorGT.begin(); it < vectorGT.end(); it++) {
-				oFile << it->readlength << "[" << it->occurrences << "] " ;
-				//oFile << "(" << it->avgBQ << ") ";
+				header << it->readlength << "[" << it->occurrences << "] " ;
+				//header << "(" << it->avgBQ << ") ";
 				if (it->occurrences >= occurMajGT) {
 					occurMajGT = it->occurrences;
 					if (it->readlength > majGT) majGT = it->readlength;
@@ -825,38 +1294,66 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	}
 	
 	//concordance = # of reads that support the majority GT / total number of reads
-	if (concordance < 0) oFile << "C:NA";
-	else oFile << "C:" << concordance;
+	if (concordance < 0) header << "C:NA";
+	else header << "C:" << concordance;
 	
-	oFile << " D:" << depth << " R:" << numReads << " S:" << numStars;
-	if (avgMapQ >= 0) oFile << " M:" << float(int(100*avgMapQ))/100;
-	else oFile << " M:NA";
+	header << " D:" << depth << " R:" << numReads << " S:" << numStars;
+	if (avgMapQ >= 0) header << " M:" << float(int(100*avgMapQ))/100;
+	else header << " M:NA";
 	
-	oFile << " GT:";
+	header << " GT:";
+	OUTPUT_RECORD record;
+	record.callsStart = callsFile.tellp();
 	callsFile << region << "\t" << secondColumn << "\t";
 	vector<int> vGT;
 	double conf = 0;
+	int allele1 = -1, allele2 = -1;        //called alleles & their confidence, for -columns
+	vector<int> calledGT;                  //every called allele (as the .calls file), for -columns
+	double called = NAN;
     if (vectorGT.size() == 0 || vectorGT[0].occurrences >= 10000) {        //if there is more than 10000x coverage, the data must be junk
-		oFile << "NA L:NA" << endl;
+		header << "NA L:NA";
 		callsFile << "NA\tNA\n";
 	}
-        else if (vectorGT.size() > 9){          // if more than 9 GTs are present
-            oFile << "NA L:NA" << endl;
+        else if (vectorGT.size() > 9 && settings.mode <= 2){          // if more than 9 GTs are present
+            header << "NA L:NA";
             callsFile << "NA\tNA\n";
         }
         else if (concordance >= 0.99){          //no need to compute confidence if all the reads agree
-            oFile << majGT << " L:50" << endl;
+            header << majGT << " L:50";
             callsFile << majGT << "L:50" << endl;
             conf = 1;
+            allele1 = allele2 = majGT;
+            calledGT.assign(1, majGT);
+            called = 50;
         }
 	else { 
+		double genotyping = wallTime();
+		perfBegin(STAGE_GENOTYPE, stageMark);
 		vGT = printGenoPerc(vectorGT, target.length(), unitLength, conf, settings.mode, likelihoods); 
+		perfEnd(stageMark);
+		if (traced) traceEvent("printGenoPerc", genotyping, region);
 		if (numReads <= 1){ conf = 0; }
 		//write genotypes to calls & repeats file
 		if (vGT.size() == 0) { throw "vGT.size() == 0.. ERROR!\n"; }
-		else if (vGT.size() == 1 && conf > 3.02) { oFile << vGT[0] << " L:" << conf << "\n"; callsFile << vGT[0] << '\t' << conf << '\n'; }
-		else if (vGT.size() == 2 && conf > 3.02) { oFile << vGT[0] << "h" << vGT[1] << " L:" << conf << "\n"; callsFile << vGT[0] << "h" << vGT[1] << '\t' << conf << '\n'; }
-		else{ oFile << "NA L:" << conf << endl; callsFile << "NA\tNA\n"; }
+		else if (vGT.size() == 1 && conf > 3.02) { header << vGT[0] << " L:" << conf; callsFile << vGT[0] << '\t' << conf << '\n'; allele1 = allele2 = vGT[0]; calledGT = vGT; }
+		else if (vGT.size() >= 2 && conf > 3.02) { header << formatGenotype(vGT) << " L:" << conf; callsFile << formatGenotype(vGT) << '\t' << conf << '\n'; allele1 = vGT.front(); allele2 = vGT.back(); calledGT = vGT; }
+		else{ header << "NA L:" << conf; callsFile << "NA\tNA\n"; }
+		called = conf;
+	}
+	if (timedOut) header << " FT:TIMEOUT";
+	record.repeatseqStart = oFile.tellp();
+	oFile << header.str() << endl;
+	if (settings.columns)
+		columns.add(locus, calledGT, called, depth, numReads, numStars, avgMapQ >= 0 ? avgMapQ : NAN, concordance >= 0 ? concordance : NAN, timedOut, vectorGT);
+	if (settings.summary) tallySummary(summary, locus, allele1 >= 0, concordance);
+	
+	//with -gvcf, loci called reference (or not called at all) are merged into blocks, & any
+	//other locus ends the block before its own record
+	bool emitAll = settings.emitAll && !settings.gvcf;
+	if (settings.gvcf) {
+		bool reference = (allele1 == target.length() && allele2 == target.length());
+		if (!timedOut && (reference || allele1 < 0)) addGVCFBlock(gvcfBlock, vcf, locus, reference, numReads, reference ? called : 0, settings);
+		else flushGVCFBlock(gvcfBlock, vcf, settings);
 	}
 	
 	// Set info for printing VCF file
@@ -867,12 +1364,12 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 	INFO.length = target.length();
 	INFO.purity = purity;
 	INFO.depth = numReads;
-	INFO.emitAll = settings.emitAll;
+	INFO.emitAll = emitAll;
+	INFO.timedOut = timedOut;
 	
-	//build list of alternates
-	vector<string> alternates;
-	for (vector<STRING_GT>::iterator it=++toPrint.begin(); it < toPrint.end(); it++)
-		alternates.push_back(it->reads.alignedSeq);
+	//the most common sequence of each allele length, counted as the reads were collected
+	vector<string> alternates = reads.sequences.representatives();
+	bool differences = reads.sequences.distinct() > 1;
 
 	bool printed = false;
 
@@ -883,15 +1380,18 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 			// print .repeats file:
 			oFile << it->reads.preSeq << " " << it->reads.alignedSeq << " " << it->reads.postSeq << it->print;
 			// finished printing to .repeats file.
-			if ((vGT.size() != 0 && conf > 3.02) || (concordance >= 0.99 && settings.emitAll)){
-				if (settings.emitAll || vGT.size() > 1 || vGT[0] != target.length() /*there's been a mutation*/){
+			if ((vGT.size() != 0 && conf > 3.02) || (concordance >= 0.99 && emitAll)){
+				if (emitAll || vGT.size() > 1 || vGT[0] != target.length() /*there's been a mutation*/){
 					// print .vcf file:
 					vector<int>::iterator tempgt = std::find(vGT.begin(), vGT.end(), it->GT);
-					if (!printed && tempgt != vGT.end() && (settings.emitAll || it->GT != target.length())){
+					if (!printed && tempgt != vGT.end() && (emitAll || it->GT != target.length())){
 						//vcf << "VCF record for " << REF << " --> " << it->reads.alignedSeq << "..\n";
 						
 						// the read represents one of our genotypes..
-						string vcfRecord = getVCF(alternates, REF, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, likelihoods);
+						perfBegin(STAGE_VCF, stageMark);
+						string vcfRecord = settings.mode > 2 ? getPolyploidVCF(alternates, differences, REF, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, vGT, conf, settings.mode)
+							: getVCF(alternates, differences, REF, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, likelihoods);
+						perfEnd(stageMark);
 						printed = true;
 						vcf << vcfRecord;
 						
@@ -906,20 +1406,41 @@ inline void print_output(string region,FastaReference* fr, stringstream &vcf,  s
 			// continue iterating through each read..
 		}
 	}
+	if (settings.pileup) pileup.add(locus, header.str(), toPrint);
+	if (settings.makeRepeatseqFile || settings.makeCallsFile) {
+		record.line = locus.line;
+		record.chr = target.startSeq;
+		record.start = target.startPos;
+		record.stop = target.stopPos;
+		record.repeatseqEnd = oFile.tellp();
+		record.callsEnd = callsFile.tellp();
+		outputIndex.push_back(record);
+	}
 	if(!printed && concordance == 1) {
-		if((concordance == -1. || concordance >= 0.99) && settings.emitAll && !printed) {
+		if((concordance == -1. || concordance >= 0.99) && emitAll && !printed) {
 
 			//remove dashes so we can get the real length
-			string alternate = alternates.front();
-			while(alternate.end() != find(alternate.begin(), alternate.end(), '-'))
-				alternate.erase(find(alternate.begin(), alternate.end(), '-'));
+			string alternate = timedOut ? timedOutAllele : toPrint[1].reads.alignedSeq;
+			alternate.erase(std::remove(alternate.begin(), alternate.end(), '-'), alternate.end());
 			int gt_index = (REF == alternate) ? REF.size() : alternate.size();
 			likelihoods[pair<int,int>(gt_index,gt_index)] = 50;
-			vcf << getVCF(alternates, REF, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, likelihoods);
+			perfBegin(STAGE_VCF, stageMark);
+			if (settings.mode > 2) vcf << getPolyploidVCF(alternates, differences, REF, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, vector<int>(1, gt_index), 50, settings.mode);
+			else vcf << getVCF(alternates, differences, REF, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, likelihoods);
+			perfEnd(stageMark);
 			printed = true;
 		}
 	}
+	if(!printed && timedOut) {
+		vcf << getNoCallVCF(centerReference, target.startSeq, target.startPos, *(leftReference.end()-1), INFO, "TIMEOUT", settings.mode);
+	}
 	assert(!vcf.fail());
+	if (traced) traceEvent("print_output", printing, region);
+	perfEnd(printMark);
+#ifdef ALLOC_PROFILE
+	allocSnapshot(allocations, allocBytes);
+	allocLocus(region, reads.seconds + wallTime() - printing, reads.allocations + allocations, reads.allocBytes + allocBytes);
+#endif
 	
 	return;
 }
@@ -954,7 +1475,7 @@ inline double retBetaMult(int* vector, int alleles){
 	
 }
 
-inline vector<int> printGenoPerc(vector<GT> vectorGT, int ref_length, int unit_size, double &confidence, int mode, map<pair<int,int>,double> & likelihoods){
+vector<int> printGenoPerc(vector<GT> vectorGT, int ref_length, int unit_size, double &confidence, int mode, map<pair<int,int>,double> & likelihoods){
 	if (ref_length > 70) ref_length = 70;
 	if (unit_size > 5) unit_size = 5;
 	else if (unit_size < 1) unit_size = 1;
@@ -971,6 +1492,7 @@ inline vector<int> printGenoPerc(vector<GT> vectorGT, int ref_length, int unit_s
 	extern bool manualErrorRate;
 
 	sort(vectorGT.begin(), vectorGT.end(), GT::sortByReadLength);
+	if (mode > 2) return genotypePolyploid(vectorGT, ref_length, unit_size, mode, confidence);
 
 	vectorGT.push_back(GT(0,0,0,0,0.0)); //allows locus to be considered homozygous
     	double pXtotal = 0;
@@ -1211,75 +1733,16 @@ pair<int,int> clip_common(vector<string>::iterator begin, vector<string>::iterat
 	return pair<int,int>(clip_begin, clip_end);
 }
 
-static bool orderStringBySize(const string & a, const string & b) {
-	return a.size() < b.size();
-}
-
-
-string getVCF(vector<string> alignments, string reference, string chr, int start, char precBase, VCF_INFO info, map<pair<int,int>,double> & likelihoods){
+//alignments: the most common sequence of each allele length, shortest first (see ALLELE_TABLE);
+//differences: whether the reads have more than one allele sequence
+string getVCF(vector<string> alignments, bool differences, string reference, string chr, int start, char precBase, VCF_INFO info, map<pair<int,int>,double> & likelihoods){
 	stringstream vcf;
 	
 	// return if no differences
-	bool differences = false;
-	for(vector<string>::const_iterator i = alignments.begin(); i != alignments.end(); i++) 
-		if(*i != *alignments.begin()) {
-			differences = true;
-			break;
-		}
-
 	if(!info.emitAll && !differences) return "";
 
-	
 	//remove -'s
-	map<string, int> dash_count;
 	reference.erase( std::remove(reference.begin(), reference.end(), '-'), reference.end() );
-	for(vector<string>::iterator i = alignments.begin(); i != alignments.end(); i++) {
-		size_t length_before = i->size();
-		i->erase( std::remove(i->begin(), i->end(), '-'), i->end() );
-		dash_count[*i] = length_before - i->size();
-	}
-
-	//remove duplicate alignments
-	{
-		map<string, int> occurrences;
-
-		for(vector<string>::const_iterator i = alignments.begin(); i != alignments.end(); i++) {
-			if(occurrences.end() == occurrences.find(*i))
-				occurrences[*i] = 1;
-			else
-				occurrences[*i]++;
-		}
-
-		alignments.clear();
-
-		//eliminate everything but the most common allele of each length
-		while(!occurrences.empty()) {
-			string current_longest_allele = occurrences.begin()->first;
-			size_t count = occurrences.begin()->second;
-			occurrences.erase(occurrences.begin());
-			vector<map<string,int>::iterator> for_deletion;
-
-			// for each allele of the same length
-			for(map<string,int>::iterator i = occurrences.begin(); i != occurrences.end(); i++) {
-				if(i->first.size() == current_longest_allele.size()) {
-					//if this allele occurs more than any other allele, keep it
-					if(i->second > count) {
-						current_longest_allele = i->first;
-						count = i->second;
-					}
-					for_deletion.push_back(i);
-				}
-			}
-			// eliminate all alelles of the current length
-			for(vector<map<string,int>::iterator>::iterator i = for_deletion.begin(); i != for_deletion.end(); i++) {
-				occurrences.erase(*i);
-			}
-
-			alignments.push_back(current_longest_allele);
-		}
-	}
-
-	sort(alignments.begin(), alignments.end(), orderStringBySize);
 	
 	//find most likely gt
 	pair<int,int> most_likely_gt;
@@ -1332,7 +1795,8 @@ string getVCF(vector<string> alignments, string reference, string chr, int start
 
 	vcf << '\t';
 	vcf << min(max(most_likely_likelihood,0.),50.) << '\t';
-	if (most_likely_likelihood > 0.8) vcf << "PASS\t"; //filter
+	if (info.timedOut) vcf << "TIMEOUT\t";
+	else if (most_likely_likelihood > 0.8) vcf << "PASS\t"; //filter
 	else vcf << ".\t";
 //vcf << endl << "$ mlgt.first: " << most_likely_gt.first << " total_clip " << total_clip << " ref_size: " << reference.size() << " total " << most_likely_gt.first - total_clip - (int)reference.size() << endl;
 	vcf << "AL=" << most_likely_gt.first - total_clip - (int)reference.size() + 1;
@@ -1376,6 +1840,47 @@ string getVCF(vector<string> alignments, string reference, string chr, int start
 	return vcf.str();
 }
 
+//VCF record for a locus left without a genotype (e.g. over its time budget)
+string getNoCallVCF(string reference, string chr, int start, char precBase, VCF_INFO info, string filter, int ploidy){
+	stringstream vcf;
+	vcf << chr << '\t' << start - 1 << '\t' << "." << '\t';
+	vcf << precBase << reference << '\t' << "." << '\t' << "." << '\t' << filter << '\t';
+	vcf << "RU=" << info.unit << ";DP=" << info.depth << ";RL=" << info.length << "\t"; //info 
+	vcf << "GT\t";
+	for (int i = 0; i < ploidy; ++i) vcf << (i ? "/." : ".");
+	vcf << '\n';
+	return vcf.str();
+}
+
+//add a locus called reference (or not called) to the open gVCF block, first writing the block
+//if the locus can't join it
+void addGVCFBlock(GVCF_BLOCK &block, stringstream &vcf, const LOCUS &locus, bool reference, int depth, double confidence, const SETTINGS_FILTERS &settings){
+	const Region &target = locus.target;
+	if (block.loci && (block.reference != reference || block.chr != target.startSeq || target.startPos <= block.end)) flushGVCFBlock(block, vcf, settings);
+	if (!block.loci) {
+		block.reference = reference;
+		block.chr = target.startSeq;
+		block.start = target.startPos;
+		block.refBase = locus.centerReference.empty() ? 'N' : locus.centerReference[0];
+		block.minDepth = depth;
+		block.minConfidence = confidence;
+	}
+	block.end = target.stopPos;
+	block.minDepth = min(block.minDepth, depth);
+	block.minConfidence = min(block.minConfidence, confidence);
+	++block.loci;
+}
+
+//write the open gVCF block, if any
+void flushGVCFBlock(GVCF_BLOCK &block, stringstream &vcf, const SETTINGS_FILTERS &settings){
+	if (!block.loci) return;
+	vcf << block.chr << '\t' << block.start << '\t' << "." << '\t' << block.refBase << '\t' << "<NON_REF>" << '\t' << "." << '\t' << "." << '\t';
+	vcf << "END=" << block.end << ";LOCI=" << block.loci << '\t' << "GT:MIN_DP:GQ" << '\t';
+	for (int i = 0; i < settings.mode; ++i) vcf << (i ? "/" : "") << (block.reference ? "0" : ".");
+	vcf << ':' << block.minDepth << ':' << int(min(max(block.minConfidence, 0.), 50.)) << '\n';
+	block.loci = 0;
+}
+
 //function to convert phred score to probability score
 double PhredToFloat(char chr){
 	// p_right-base = 1 - 10^(-Q/10)
@@ -1383,6 +1888,13 @@ double PhredToFloat(char chr){
 	return (1 - pow(10,temp/-10));
 }
 
+//seconds on a monotonic clock, for timing loci
+double wallTime(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 //function to ensure filepath is in the current directory
 string setToCD (string filepath){
 	if (filepath.rfind('/') != -1){ filepath = filepath.substr( filepath.rfind('/') + 1, -1); }
@@ -1405,14 +1917,22 @@ void buildFastaIndex(string fastaFileName){
 	fai->writeIndexFile(fastaFileName + fai->indexFileExtension());
 }	
 
-void printHeader(ofstream &vcf){
+void printHeader(ofstream &vcf, const SETTINGS_FILTERS &settings){
 	vcf << "##fileformat=VCFv4.1" << endl;
+	if (settings.budget) vcf << "##FILTER=<ID=TIMEOUT,Description=\"Locus went over its time budget of " << settings.budget << "s; its reads may be downsampled\">" << endl;
 	vcf << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">" << endl;
 	vcf << "##FORMAT=<ID=GL,Number=G,Type=Float,Description=\"Genotype likelihood\">" << endl;
 	vcf << "##INFO=<ID=AL,Number=A,Type=Integer,Description=\"Allele Length Offset(s)\">" << endl;
 	vcf << "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Total Depth\">" << endl;
 	vcf << "##INFO=<ID=RU,Number=1,Type=String,Description=\"Repeat Unit\">" << endl;
 	vcf << "##INFO=<ID=RL,Number=1,Type=Integer,Description=\"Reference Length of Repeat\">" << endl;
+	if (settings.gvcf) {
+		vcf << "##ALT=<ID=NON_REF,Description=\"Any allele other than the reference at the loci of the block\">" << endl;
+		vcf << "##INFO=<ID=END,Number=1,Type=Integer,Description=\"Last position of the last locus of the block; only the catalog loci of the block are genotyped\">" << endl;
+		vcf << "##INFO=<ID=LOCI,Number=1,Type=Integer,Description=\"Consecutive catalog loci merged into the block\">" << endl;
+		vcf << "##FORMAT=<ID=MIN_DP,Number=1,Type=Integer,Description=\"Minimum depth of the loci of the block\">" << endl;
+		vcf << "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Minimum confidence of the reference calls of the block\">" << endl;
+	}
 	vcf << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE" << endl;
 }
 
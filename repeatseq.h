@@ -7,12 +7,15 @@
 #include <sstream>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <iomanip>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
 
 //from bamtools:
 #include <api/BamReader.h>
@@ -37,8 +40,22 @@ struct Sequences {
 	Sequences(string, string, string, bool);
 };
 
+//the fields of a read's .repeatseq line, kept for -pileup (see pileup.cpp):
+struct PILEUP_READ {
+	int position;
+	int readSize;
+	int flankLeft, flankRight;
+	int baseQuality;                        // 10000 x the average base quality
+	int flags;                              // bit mask of the letters of F:
+	vector<CigarOp> cigar;
+	string name;
+};
+
 struct STRING_GT {
 	string print;
+	PILEUP_READ pileup;
+	string family;                          // key of the read's duplicate family, for -families
+	string realigned;                       // allele given by -realign, if it replaced the CIGAR's
 	Sequences reads;
 	int GT;
 	bool paired;
@@ -65,7 +82,34 @@ struct SETTINGS_FILTERS {
 	int readLengthMax;
 	int consLeftFlank;
 	int consRightFlank;
+	int flankErrors;                    // edit distance allowed on a flank failing -L/-R (0 = off)
+	int flankWindow;                    // ... over this many flank bases next to the repeat
 	int MapQuality;
+	int deepReads;
+	double budget;
+	double progress;
+	string metricsFile;
+	bool threadStats;
+	string traceFile;
+	int traceSample;
+	double traceFrom, traceTo;
+	bool perfCounters;
+	bool dryRun;
+	double readCost;                    // microseconds of thread time per read (for -dryrun estimates)
+	bool columns;                       // write the per-locus results to a columns file
+	bool pileup;                        // write the reads of each locus to a binary pileup file
+	bool gvcf;                          // merge reference & no-call loci into gVCF blocks
+	bool summary;                       // write call rates & concordance by unit size & length
+	bool qc;                            // count depth & spanning reads only, without genotyping
+	bool families;                      // collapse duplicate read families before genotyping
+	string umiTag;                      // tag holding the UMI of a read (families by UMI)
+	int anchorK;                        // length of the flank anchors of "repeatseq fastq"
+	int realignUnits;                   // units added & removed for the haplotypes of -realign (0 = off)
+	bool longReads;                     // index the CIGAR of each read & walk only the window of each locus
+	double captureSeconds;
+	set<string> captureRegions;
+	string captureDir;
+	string options;                     // the options of the run (for the bundles of captured loci)
 	string paramString;
 	
 	SETTINGS_FILTERS(){
@@ -81,7 +125,33 @@ struct SETTINGS_FILTERS {
 		readLengthMax = 0;
 		consLeftFlank = 3;
 		consRightFlank = 3;
+		flankErrors = 0;
+		flankWindow = 32;
 		MapQuality = 0;
+		deepReads = 10000;
+		budget = 0;
+		progress = 0;
+		metricsFile = "";
+		threadStats = false;
+		traceFile = "";
+		traceSample = 1;
+		traceFrom = traceTo = 0;
+		perfCounters = false;
+		dryRun = false;
+		readCost = 20;
+		columns = false;
+		pileup = false;
+		gvcf = false;
+		summary = false;
+		qc = false;
+		families = false;
+		umiTag = "";
+		anchorK = 12;
+		realignUnits = 0;
+		longReads = false;
+		captureSeconds = 0;
+		captureDir = "capture";
+		options = "";
 		paramString = "";
 	}
 };
@@ -98,7 +168,7 @@ struct GT {
     static bool sortByReadLength(const GT & a, const GT & b) { return (a.readlength > b.readlength); }
 };
 
-//counter struct is used in array for table files:
+//counter struct is used in the tables of -summary (see summary.cpp):
 struct counter {
 	int numGT;              //number of repeats that have a GT
 	int numRepeats;         //number of total repeats
@@ -108,6 +178,18 @@ struct counter {
 	counter();
 };
 
+//totals of the loci of a -qc run (see qc.cpp):
+struct QC_TOTALS {
+	long loci;
+	long spanned;                           // loci with at least one spanning read
+	long depth, spanning, noCigar, mapQSum;
+	
+	QC_TOTALS();
+};
+
+//loci tallied by repeat unit size & reference length bin, for -summary (see summary.cpp):
+typedef map<pair<int,int>, counter> SUMMARY_TABLE;
+
 //structure to be passed to VCF-writing function:
 struct VCF_INFO {
 	string chr;
@@ -117,6 +199,7 @@ struct VCF_INFO {
 	int purity;
 	int depth;
 	bool emitAll;
+	bool timedOut;
 };
 
 //class for parsing region argument:
@@ -126,25 +209,382 @@ public:
 	int startPos;
 	int stopPos;
 	
+	Region();
 	Region(string& region);
-	int length(void);
+	int length(void) const;
+};
+
+//a read after a single walk of its CIGAR (see parseCigar()); the window for every locus
+//the read overlaps is cut from it by projectLocus() without walking the CIGAR again:
+struct PROJECTION {
+	string expanded;                        // read bases lined up to the reference ('-' deleted, 'd' inserted, 'S' soft clipped)
+	vector<int> steps;                      // index into expanded of each reference-consuming position
+	vector<pair<int,string> > insertions;   // number of steps preceding each insertion & its (shifted) bases
+	int alignStart;                         // 1-based alignment start
+	int clipShift;                          // length of a leading soft clip
+	int queryStart;                         // read position of the first base walked (see longreads.cpp)
+	int readSize;
+	double avgBQ;
+	bool valid;                             // false if the CIGAR holds a skipped region ('N')
+	
+	//with -longreads, the CIGAR index of the read & the operations of the window last walked:
+	vector<int> opRef;                      // reference position at which each operation starts
+	vector<int> opQuery;                    // read position at which each operation starts
+	int alignEnd;                           // reference position after the alignment
+	vector<CigarOp> window;
+};
+
+//a candidate allele of a locus within its flanks, for -realign (see realign.cpp):
+struct HAPLOTYPE {
+	string allele;                          // the repeat
+	string bases;                           // the repeat & its flanks
+	int segments;                           // REALIGN_LANES-score segments of the profile per base
+	vector<int16_t> profile;                // striped scores of each base against the haplotype
+};
+
+//a repeat from the region file:
+struct LOCUS {
+	size_t line;                            // index of the locus in the region file
+	string region;
+	string secondColumn;
+	string UnitSeq;
+	int unitLength;
+	double purity;
+	Region target;
+	int left, right;                        // 0-based bounds of the region handed to the BAM index
+	string leftReference, centerReference, rightReference;
+	string leftFlank, rightFlank;           // -flankwindow bases on either side of the repeat, for -flankerrors
+	vector<HAPLOTYPE> haplotypes;           // candidate alleles, for -realign
+	int realignFlank;                       // reference bases before the repeat in the haplotypes
+};
+
+//the allele sequences of a locus' reads & how many reads have each (see alleles.cpp):
+class ALLELE_TABLE {
+public:
+	ALLELE_TABLE();
+	void add(const string &allele, uint32_t count = 1);
+	void merge(const ALLELE_TABLE &other);
+	size_t distinct() const { return used; }
+	vector<string> representatives() const;
+
+private:
+	struct ENTRY {
+		uint64_t hash;
+		uint32_t length, count;             // count is 0 for an empty slot
+		size_t word;                        // first word of the packed sequence in words
+		string text;                        // the sequence, if it holds letters other than ACGT
+		ENTRY() : hash(0), length(0), count(0), word(0) {}
+	};
+	vector<ENTRY> slots;
+	vector<uint64_t> words;                 // sequences packed 2 bits a base, 32 bases a word
+	size_t used;
+
+	static bool pack(const string &allele, vector<uint64_t> &packed);
+	size_t find(const vector<uint64_t> &packed, const string &text, uint32_t length, uint64_t hash) const;
+	void insert(const vector<uint64_t> &packed, const string &text, uint32_t length, uint64_t hash, uint32_t count);
+	string sequence(const ENTRY &entry) const;
+};
+
+//the reads collected for a locus (for a deep locus, those of one batch of its reads):
+struct LOCUS_READS {
+	int depth;
+	int numStars;
+	int spanning;                           // reads counted by qcRead(), for -qc
+	long mapQSum;                           // ... & their summed MapQ
+	vector<STRING_GT> toPrint;
+	vector<GT> alleles;                     // allele histogram, in order of first appearance
+	ALLELE_TABLE sequences;                 // allele sequences of the reads, for getVCF()
+	vector<int16_t> realignWork;            // scratch of realignRead(), for -realign
+	double started;                         // wallTime() of the first read (0 if none yet)
+	bool truncated;                         // reads are no longer collected (over the time budget)
+#ifdef ALLOC_PROFILE
+	double seconds;                         // time spent in addRead() & print_output()
+	uint64_t allocations, allocBytes;       // ... & what they allocated
+#endif
+	
+	LOCUS_READS();
+	void merge(LOCUS_READS &);
+};
+
+//class for estimating the reads in a region from the BAM index (see bamindex.cpp):
+class BaiIndex {
+public:
+	bool load(string filename);
+	double estimateReads(int refID, int start, int stop, int readLength) const;
+	
+private:
+	struct REFERENCE {
+		vector<uint64_t> linear;            // virtual offset of the first read of each 16kb window
+		uint64_t begin, end;                // virtual offsets of the reference's first & last reads
+		uint64_t mapped, unmapped;
+	};
+	vector<REFERENCE> references;
+};
+
+//progress of the run through the region file, shared by the worker threads (see progress.cpp):
+struct PROGRESS {
+	vector<string> chromosomes;             // in order of first appearance in the region file
+	vector<int> chromosomeOf;               // chromosome of each line of the region file
+	vector<long> total, done;               // lines of each chromosome, & those finished
+	
+	void init(const vector<string> &regions);
+};
+
+//the per-locus results of a worker, column by column (see columns.cpp):
+struct RESULT_COLUMNS {
+	vector<uint32_t> line;                  // index of the locus in the region file
+	vector<string> region;
+	vector<string> genotype;                // called allele lengths, as formatGenotype() ("" if not called)
+	vector<int> allele1, allele2;           // shortest & longest called allele length (-1 if not called)
+	vector<float> confidence, mapQ, concordance;    // NaN if NA
+	vector<int> depth, reads, starred;
+	vector<uint8_t> timeout;
+	vector<int> histogramSize;              // alleles in the histogram of each locus...
+	vector<int> histogramLength, histogramReads;    // ... & the entries, locus after locus
+	
+	void add(const LOCUS&, const vector<int>&, double, int, int, int, double, double, bool, const vector<GT>&);
+	void append(const RESULT_COLUMNS&);
+};
+
+//class for reading a columns file a column & a group of rows at a time:
+class ColumnReader {
+public:
+	struct GROUP {
+		uint64_t first;
+		uint32_t rows, entries;             // loci, & entries of their allele histograms
+		vector<pair<uint64_t,uint64_t> > chunks;    // offset & bytes of each column (deflated)...
+		vector<uint64_t> encoded;                   // ... & its bytes once inflated
+	};
+	vector<string> columns;
+	string types;
+	vector<GROUP> groups;
+	uint64_t rows;
+	
+	bool open(string filename);
+	int column(const string &name) const;
+	vector<string> decode(size_t group, int column);
+	
+private:
+	ifstream in;
+	string read(uint64_t offset, uint64_t bytes);
+};
+
+//a run of loci called reference (or not called) waiting to be written as one gVCF record:
+struct GVCF_BLOCK {
+	int loci;                               // 0 if no block is open
+	bool reference;                         // 0/0 block (or ./. if false)
+	string chr;
+	int start, end;
+	char refBase;
+	int minDepth;
+	double minConfidence;
+	
+	GVCF_BLOCK() : loci(0) {}
+};
+
+//where the records of a locus start & end in the output of its worker (see outputindex.cpp):
+struct OUTPUT_RECORD {
+	uint32_t line;
+	string chr;
+	int start, stop;
+	uint64_t repeatseqStart, repeatseqEnd;
+	uint64_t callsStart, callsEnd;
 };
 
+//encodes the loci of a worker into compressed blocks of a pileup file (see pileup.cpp):
+class PILEUP_WRITER {
+public:
+	string output;                          // finished blocks
+	
+	PILEUP_WRITER();
+	void add(const LOCUS&, const string&, const vector<STRING_GT>&);
+	void flush();
+	
+private:
+	string block;
+	uint32_t loci;                          // loci in the block
+	map<string,size_t> names;               // dictionary of the block's read names
+	string lastName;
+};
+
+//reads of a deep run of loci are collected in batches of this many:
+#define DEEP_BATCH_SIZE 4096
+
+//with -longreads, reads may be this long (loci this close together are read as one run):
+#define LONG_READ_SIZE 100000
+#define LONG_READ_PAD 16            // reference bases walked beyond the flanks printed of each locus
+
+//with -flankerrors, the longest flank window (a bit of a 64-bit word per base, see flanks.cpp):
+#define FLANK_WORD 64
+
+//state of each worker thread:
+typedef struct worker_data {
+    worker_data(const SETTINGS_FILTERS & settings, const vector<string> & regions)
+    : settings(settings)
+    , regions(regions)
+    , id(0)
+    , progress(NULL)
+    , lociDone(0)
+    , readsDone(0)
+    , bytesDone(0)
+    , started(0)
+    , finished(0)
+    , ioTime(0)
+    , waitTime(0)
+    , helperTime(0)
+    {}
+    FastaReference * fr;
+    stringstream vcfFile, oFile, callsFile;
+    const SETTINGS_FILTERS & settings;
+    const vector<string> & regions;
+    size_t region_start, region_stop;
+    pthread_t thread;
+    BamReader reader;
+    const BaiIndex * index;                 // NULL if the index could not be read
+    size_t id;
+    PROGRESS * progress;
+    long lociDone, readsDone, bytesDone;    // progress counters (updated with __sync builtins)
+    double started, finished;               // wallTime() at the start & end of the thread
+    double ioTime;                          // seconds spent in BamReader calls
+    double waitTime;                        // seconds spent waiting for threads sharing a deep batch
+    double helperTime;                      // seconds those threads spent on the batches
+    vector<pair<LOCUS,double> > captures;   // loci to capture & the seconds they took (see capture.cpp)
+    RESULT_COLUMNS columns;                 // results of the loci, for -columns
+    PILEUP_WRITER pileup;                   // reads of the loci, for -pileup
+    vector<OUTPUT_RECORD> outputIndex;      // records of the loci in oFile & callsFile
+    GVCF_BLOCK gvcfBlock;                   // open block of the VCF, for -gvcf
+    SUMMARY_TABLE summary;                  // call rates & concordance of the loci, for -summary
+    stringstream qcFile;                    // lines of the loci, for -qc
+    QC_TOTALS qcTotals;
+} worker_data_t;
+
+//stages measured with hardware counters (see perfcounters.cpp):
+enum PERF_STAGE { STAGE_PARSECIGAR, STAGE_ADDREAD, STAGE_EXPAND, STAGE_GENOTYPE, STAGE_VCF, STAGE_PRINT, STAGE_CONSOLIDATE, PERF_STAGES };
+
+//counter values at the start of a stage:
+struct PERF_MARK {
+	int stage;
+	int outer;                              // the stage this one is nested in
+	uint64_t values[4];
+	bool valid;
+};
+
+//allocation profiling, built in with "make ALLOC_PROFILE=1" (see allocprofile.cpp):
+#ifdef ALLOC_PROFILE
+int allocEnter(int);
+void allocLeave(int);
+void allocSnapshot(uint64_t&, uint64_t&);
+void allocLocus(const string&, double, uint64_t, uint64_t);
+void printAllocStats();
+#else
+inline int allocEnter(int) { return PERF_STAGES; }
+inline void allocLeave(int) {}
+inline void printAllocStats() {}
+#endif
+
+//state of the thread reporting progress:
+typedef struct reporter_data {
+    const SETTINGS_FILTERS * settings;
+    const vector<worker_data_t *> * workers;
+    PROGRESS * progress;
+    string bam;
+    double started, lastTime;
+    long lastLoci, lastReads, lastBytes;    // counts at the last report
+    int stop;                               // set (with __sync builtins) to stop the reporter
+    pthread_t thread;
+} reporter_data_t;
+
 //function declarations:
 float fact(int);
 double retSumFactOverIndFact(int, int, int);
-string getVCF(vector<string>, string, string, int, char, VCF_INFO, map<pair<int,int>,double> &);
+void initLogFactorial();
+string getVCF(vector<string>, bool, string, string, int, char, VCF_INFO, map<pair<int,int>,double> &);
+string getNoCallVCF(string, string, int, char, VCF_INFO, string, int);
+void addGVCFBlock(GVCF_BLOCK&, stringstream&, const LOCUS&, bool, int, double, const SETTINGS_FILTERS&);
+void flushGVCFBlock(GVCF_BLOCK&, stringstream&, const SETTINGS_FILTERS&);
 double PhredToFloat(char);
 string setToCD (string);
 bool fileCheck(string);
 void buildFastaIndex(string);
-void printHeader(ofstream&);
+void printHeader(ofstream&, const SETTINGS_FILTERS&);
+double wallTime();
 void parseSettings(char**, int, SETTINGS_FILTERS&, string&, string&, string&);
 void printArguments();
 vector<int> printGenoPerc(vector<GT>, int, int, double&, int, map<pair<int, int>, double> &);
+vector<int> genotypePolyploid(const vector<GT>&, int, int, int, double&);
+string formatGenotype(const vector<int>&);
+string getPolyploidVCF(vector<string>, bool, string, string, int, char, VCF_INFO, vector<int>, double, int);
 bool fileCheck(string);
 void buildFastaIndex(string);
-void print_output(string, FastaReference*, stringstream&, stringstream&, stringstream&,  const SETTINGS_FILTERS&, BamReader&);
+bool initLocus(string, FastaReference*, const SETTINGS_FILTERS&, LOCUS&);
+void parseCigar(const BamAlignment&, PROJECTION&);
+size_t flankMatches(const char*, const char*, size_t);
+size_t flankMatchesFromEnd(const char*, const char*, size_t);
+void upperCase(string&);
+void walkCigar(vector<CigarOp>::const_iterator, vector<CigarOp>::const_iterator, const string&, size_t, PROJECTION&);
+void indexCigar(const BamAlignment&, PROJECTION&);
+void windowCigar(const BamAlignment&, PROJECTION&, int, int);
+bool projectLocus(const PROJECTION&, int, int, string&, vector<string>&);
+int alleleLength(const string&, const string&);
+string alleleSequence(const string&, const string&);
+void decodeInsertions(string&);
+void tallyAllele(vector<GT>&, const STRING_GT&);
+string familyKey(const BamAlignment&, const SETTINGS_FILTERS&);
+void collapseFamilies(LOCUS_READS&);
+void buildHaplotypes(LOCUS&, FastaReference*, const SETTINGS_FILTERS&);
+int realignRead(const LOCUS&, const BamAlignment&, const PROJECTION&, const SETTINGS_FILTERS&, vector<int16_t>&, string&);
+void addRead(const LOCUS&, LOCUS_READS&, const BamAlignment&, const PROJECTION&, const SETTINGS_FILTERS&);
+void scanRegions(worker_data_t&);
+void regionDone(worker_data_t&, size_t);
+void readDone(worker_data_t&, const BamAlignment&);
+void reportProgress(reporter_data_t&, bool);
+void * reporter_thread(void *);
+void printThreadStats(const vector<worker_data_t *>&);
+string formatTime(double);
+int dryRun(const SETTINGS_FILTERS&, const string&, const string&, const vector<string>&);
+void initTrace(const SETTINGS_FILTERS&);
+void traceThread(const string&);
+bool traceLocus(size_t);
+void traceEvent(const char*, double, const string& = "", double = 0);
+void writeTrace(string);
+void initPerf(const SETTINGS_FILTERS&);
+void perfThread();
+void perfThreadDone();
+void perfBegin(int, PERF_MARK&);
+void perfEnd(const PERF_MARK&);
+void printPerfStats();
+void captureLocus(worker_data_t&, const LOCUS&, double);
+void writeCaptures(worker_data_t&);
+int replayBundle(int, char**);
+int runRepeatseq(int, char**);
+bool writeColumns(string, const vector<worker_data_t *>&);
+int printColumns(int, char**);
+int pileupFlags(const BamAlignment&);
+bool writePileup(string, vector<worker_data_t *>&);
+int printPileup(int, char**);
+bool writeOutputIndex(string, const vector<worker_data_t *>&, bool);
+int viewOutput(int, char**);
+int discoverRepeats(int, char**);
+int scanFastq(int, char**);
+void print_output(const LOCUS&, LOCUS_READS&, stringstream&, stringstream&, stringstream&, RESULT_COLUMNS&, PILEUP_WRITER&, vector<OUTPUT_RECORD>&, GVCF_BLOCK&, SUMMARY_TABLE&, const SETTINGS_FILTERS&);
+int flankDistance(const PROJECTION&, const LOCUS&, bool, int);
+void tallySummary(SUMMARY_TABLE&, const LOCUS&, bool, double);
+void qcRead(const LOCUS&, LOCUS_READS&, const BamAlignment&, const SETTINGS_FILTERS&);
+void qcLocus(const LOCUS&, const LOCUS_READS&, stringstream&, QC_TOTALS&);
+bool writeQC(string, const vector<worker_data_t *>&);
+bool writeSummary(string, const vector<worker_data_t *>&);
 
 inline bool vectorGTsort(GT a, GT b) { return (a.occurrences > b.occurrences); }
 
+//same overlap test BamReader applies to the reads of a region set with SetRegion()
+inline bool overlapsLocus(const BamAlignment &al, const LOCUS &locus){
+	if (al.Position >= locus.right) return false;
+	return (al.Position >= locus.left || al.GetEndPosition() > locus.left);
+}
+
+//inserted bases are carried shifted up by one letter until the reads are expanded for printing:
+inline bool isInsertedBase(char c) { return (c == 'B' || c == 'U' || c == 'D' || c == 'H' || c == 'O'); }
+
+//a position of a read window holding a base of the read (not padding, a gap in the reference or a soft clip):
+inline bool isReadBase(char c) { return (c != ' ' && c != 'x' && c != 'X' && c != 'S'); }
+
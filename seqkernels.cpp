@@ -0,0 +1,152 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Sequence kernels module: the byte loops run on the bases of every read of every locus
+//
+// flankMatches() & flankMatchesFromEnd() count the bases of a read's flank matching the reference
+// from either end (a read base matches its reference base or, marking an insertion after it, the
+// base's lower case); addRead() takes numMatchesL & numMatchesR from them.  upperCase() upper-cases
+// reference & read sequence in place.  Each is compiled three ways: a byte at a time, 16 bytes a
+// step with SSE2 (8 bytes for the default 8-base flanks), & 32 bytes a step with AVX2.  The widest
+// the processor supports is picked once, when the program starts.
+
+#include "repeatseq.h"
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define SEQ_KERNELS_AVX2
+#endif
+
+//a byte at a time:
+size_t flankMatchesScalar(const char *read, const char *ref, size_t n){
+	size_t i = 0;
+	while (i < n && (read[i] == ref[i] || read[i] == char(ref[i] + 32))) ++i;
+	return i;
+}
+
+size_t flankMatchesFromEndScalar(const char *read, const char *ref, size_t n){
+	size_t i = n;
+	while (i > 0 && (read[i-1] == ref[i-1] || read[i-1] == char(ref[i-1] + 32))) --i;
+	return n - i;
+}
+
+void upperCaseScalar(char *s, size_t n){
+	for (size_t i = 0; i < n; ++i) if (s[i] >= 'a' && s[i] <= 'z') s[i] -= 32;
+}
+
+#ifdef __SSE2__
+//bit k set if byte k of read matches byte k of ref
+inline int matchMask(__m128i read, __m128i ref){
+	__m128i lower = _mm_add_epi8(ref, _mm_set1_epi8(32));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(read, ref), _mm_cmpeq_epi8(read, lower)));
+}
+
+size_t flankMatchesSSE2(const char *read, const char *ref, size_t n){
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		int mask = matchMask(_mm_loadu_si128((const __m128i *) (read + i)), _mm_loadu_si128((const __m128i *) (ref + i)));
+		if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+	}
+	if (i + 8 <= n) {
+		int mask = matchMask(_mm_loadl_epi64((const __m128i *) (read + i)), _mm_loadl_epi64((const __m128i *) (ref + i))) & 0xFF;
+		if (mask != 0xFF) return i + __builtin_ctz(~mask);
+		i += 8;
+	}
+	return i + flankMatchesScalar(read + i, ref + i, n - i);
+}
+
+size_t flankMatchesFromEndSSE2(const char *read, const char *ref, size_t n){
+	size_t i = n;
+	for (; i >= 16; i -= 16) {
+		int mask = matchMask(_mm_loadu_si128((const __m128i *) (read + i - 16)), _mm_loadu_si128((const __m128i *) (ref + i - 16)));
+		if (mask != 0xFFFF) return n - i + __builtin_clz(~mask << 16);
+	}
+	if (i >= 8) {
+		int mask = matchMask(_mm_loadl_epi64((const __m128i *) (read + i - 8)), _mm_loadl_epi64((const __m128i *) (ref + i - 8))) & 0xFF;
+		if (mask != 0xFF) return n - i + __builtin_clz(~mask << 24);
+		i -= 8;
+	}
+	return n - i + flankMatchesFromEndScalar(read, ref, i);
+}
+
+void upperCaseSSE2(char *s, size_t n){
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *) (s + i));
+		__m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+		_mm_storeu_si128((__m128i *) (s + i), _mm_sub_epi8(c, _mm_and_si128(lower, _mm_set1_epi8(32))));
+	}
+	upperCaseScalar(s + i, n - i);
+}
+#endif
+
+#ifdef SEQ_KERNELS_AVX2
+__attribute__((target("avx2"))) inline unsigned matchMaskAVX2(const char *read, const char *ref){
+	__m256i r = _mm256_loadu_si256((const __m256i *) read), f = _mm256_loadu_si256((const __m256i *) ref);
+	__m256i lower = _mm256_add_epi8(f, _mm256_set1_epi8(32));
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(r, f), _mm256_cmpeq_epi8(r, lower)));
+}
+
+__attribute__((target("avx2"))) size_t flankMatchesAVX2(const char *read, const char *ref, size_t n){
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		unsigned mask = matchMaskAVX2(read + i, ref + i);
+		if (mask != 0xFFFFFFFFu) return i + __builtin_ctz(~mask);
+	}
+	return i + flankMatchesSSE2(read + i, ref + i, n - i);
+}
+
+__attribute__((target("avx2"))) size_t flankMatchesFromEndAVX2(const char *read, const char *ref, size_t n){
+	size_t i = n;
+	for (; i >= 32; i -= 32) {
+		unsigned mask = matchMaskAVX2(read + i - 32, ref + i - 32);
+		if (mask != 0xFFFFFFFFu) return n - i + __builtin_clz(~mask);
+	}
+	return n - i + flankMatchesFromEndSSE2(read, ref, i);
+}
+
+__attribute__((target("avx2"))) void upperCaseAVX2(char *s, size_t n){
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i c = _mm256_loadu_si256((const __m256i *) (s + i));
+		__m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+		_mm256_storeu_si256((__m256i *) (s + i), _mm256_sub_epi8(c, _mm256_and_si256(lower, _mm256_set1_epi8(32))));
+	}
+	upperCaseSSE2(s + i, n - i);
+}
+#endif
+
+//the kernels used, picked when the program starts:
+struct SEQ_KERNELS {
+	size_t (*flankMatches)(const char *, const char *, size_t);
+	size_t (*flankMatchesFromEnd)(const char *, const char *, size_t);
+	void (*upperCase)(char *, size_t);
+	
+	SEQ_KERNELS(){
+		flankMatches = flankMatchesScalar;
+		flankMatchesFromEnd = flankMatchesFromEndScalar;
+		upperCase = upperCaseScalar;
+#ifdef __SSE2__
+		flankMatches = flankMatchesSSE2;
+		flankMatchesFromEnd = flankMatchesFromEndSSE2;
+		upperCase = upperCaseSSE2;
+#endif
+#ifdef SEQ_KERNELS_AVX2
+		__builtin_cpu_init();    //needed before static constructors have run
+		if (__builtin_cpu_supports("avx2")) {
+			flankMatches = flankMatchesAVX2;
+			flankMatchesFromEnd = flankMatchesFromEndAVX2;
+			upperCase = upperCaseAVX2;
+		}
+#endif
+	}
+};
+static const SEQ_KERNELS kernels;
+
+//bases of a read's flank matching the reference, from its first base
+size_t flankMatches(const char *read, const char *ref, size_t n){ return kernels.flankMatches(read, ref, n); }
+
+//bases of a read's flank matching the reference, from its last base
+size_t flankMatchesFromEnd(const char *read, const char *ref, size_t n){ return kernels.flankMatchesFromEnd(read, ref, n); }
+
+void upperCase(string &sequence){ if (!sequence.empty()) kernels.upperCase(&sequence[0], sequence.length()); }
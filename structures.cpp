@@ -56,6 +56,46 @@ GT::GT(int rl, int oc, int rev, int minF, double avgbq){
 	avgBQ = avgbq;
 };
 
+LOCUS_READS::LOCUS_READS(){
+	depth = 0;
+	numStars = 0;
+	spanning = 0;
+	mapQSum = 0;
+	started = 0;
+	truncated = false;
+#ifdef ALLOC_PROFILE
+	seconds = 0;
+	allocations = allocBytes = 0;
+#endif
+}
+
+//append the reads of a later batch, merging allele histograms in order of first appearance
+void LOCUS_READS::merge(LOCUS_READS &other){
+	depth += other.depth;
+	numStars += other.numStars;
+	spanning += other.spanning;
+	mapQSum += other.mapQSum;
+	if (!started || (other.started && other.started < started)) started = other.started;
+#ifdef ALLOC_PROFILE
+	seconds += other.seconds;
+	allocations += other.allocations;
+	allocBytes += other.allocBytes;
+#endif
+	toPrint.insert(toPrint.end(), other.toPrint.begin(), other.toPrint.end());
+	sequences.merge(other.sequences);
+	for (vector<GT>::iterator it = other.alleles.begin(); it < other.alleles.end(); ++it) {
+		vector<GT>::iterator jt = alleles.begin();
+		while (jt < alleles.end() && jt->readlength != it->readlength) ++jt;
+		if (jt == alleles.end()) alleles.push_back(*it);
+		else {
+			jt->occurrences += it->occurrences;
+			jt->reverse += it->reverse;
+			jt->avgMinFlank += it->avgMinFlank;
+			jt->avgBQ += it->avgBQ;
+		}
+	}
+}
+
 counter::counter(){
 	numGT = 0;
 	numRepeats = 0;
@@ -63,6 +103,11 @@ counter::counter(){
 	numRepeats2 = 0;
 }
 
+Region::Region() {
+	startPos = -1;
+	stopPos = -1;
+}
+
 Region::Region(string& region) {
 	startPos = -1;
 	stopPos = -1;
@@ -84,7 +129,7 @@ Region::Region(string& region) {
 	}
 }
 
-int Region::length(void) {
+int Region::length(void) const {
 	if (stopPos > 0) {
 		return stopPos - startPos + 1;
 	} else {
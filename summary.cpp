@@ -0,0 +1,64 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Summary module: call rates & concordance by repeat unit size & length (-summary)
+//
+// print_output() tallies each locus into the SUMMARY_TABLE of its worker, keyed on the unit size
+// & the bin of SUMMARY_LENGTH_BIN reference lengths of the locus: a counter holding the loci, the
+// loci called, the loci with a concordance (two or more reads) & the sum of their concordances.
+// Once the workers are done, main() merges their tables & writes them to <in.bam>.summary as a
+// tab-delimited table, one row per unit size & length bin, with a row of all loci at the end.
+
+#include "repeatseq.h"
+
+#define SUMMARY_LENGTH_BIN 10
+
+void tallySummary(SUMMARY_TABLE &summary, const LOCUS &locus, bool called, double concordance){
+	int length = locus.target.length();
+	counter &tally = summary[pair<int,int>(locus.unitLength, length - length % SUMMARY_LENGTH_BIN)];
+	++tally.numRepeats;
+	if (called) ++tally.numGT;
+	if (concordance >= 0) {
+		++tally.numRepeats2;
+		tally.tallyC += concordance;
+	}
+}
+
+//a row of the summary table
+void printSummaryRow(ofstream &out, const string &unit, const string &lengths, const counter &tally){
+	out << unit << '\t' << lengths << '\t' << tally.numRepeats << '\t' << tally.numGT << '\t';
+	out << double(tally.numGT) / tally.numRepeats << '\t' << tally.numRepeats2 << '\t';
+	if (tally.numRepeats2) out << tally.tallyC / tally.numRepeats2 << '\n';
+	else out << "NA\n";
+}
+
+bool writeSummary(string filename, const vector<worker_data_t *> &workers){
+	SUMMARY_TABLE summary;
+	counter all;
+	for (size_t thread = 0; thread < workers.size(); ++thread) {
+		for (SUMMARY_TABLE::const_iterator it = workers[thread]->summary.begin(); it != workers[thread]->summary.end(); ++it) {
+			counter &tally = summary[it->first];
+			tally.numRepeats += it->second.numRepeats;
+			tally.numGT += it->second.numGT;
+			tally.numRepeats2 += it->second.numRepeats2;
+			tally.tallyC += it->second.tallyC;
+		}
+	}
+	
+	ofstream out(filename.c_str());
+	if (!out.is_open()) return false;
+	out << "#unit\tlength\tloci\tcalled\tcall_rate\tloci_2plus_reads\tmean_concordance\n";
+	for (SUMMARY_TABLE::iterator it = summary.begin(); it != summary.end(); ++it) {
+		stringstream unit, lengths;
+		unit << it->first.first;
+		lengths << it->first.second << '-' << it->first.second + SUMMARY_LENGTH_BIN - 1;
+		printSummaryRow(out, unit.str(), lengths.str(), it->second);
+		all.numRepeats += it->second.numRepeats;
+		all.numGT += it->second.numGT;
+		all.numRepeats2 += it->second.numRepeats2;
+		all.tallyC += it->second.tallyC;
+	}
+	if (all.numRepeats) printSummaryRow(out, "all", "all", all);
+	return !out.fail();
+}
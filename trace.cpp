@@ -0,0 +1,125 @@
+//*----------------------------------------------------------------------------------------*
+//*RepeatSeq is available through the Virginia Tech non-commerical license.                *
+//*For more details on the license and use, see license.txt included in this distribution. *
+//*----------------------------------------------------------------------------------------*
+// Trace module: a timeline of the stages of each thread, written as a Chrome Trace Event file
+//
+// Each thread records the spans of its stages (reading a run of loci, printing a locus, expanding
+// its reads, collecting a deep batch, consolidating the output...) into a ring buffer of its own,
+// so recording takes no locks; the oldest events are overwritten once a buffer is full.  Only
+// every Nth locus is traced (-tracesample) and only events within a window of the run
+// (-tracewindow) are kept, to keep the overhead & the file small.  The file opens in Perfetto or
+// chrome://tracing.
+
+#include "repeatseq.h"
+#include <string.h>
+
+//events kept per thread:
+#define TRACE_BUFFER_SIZE 65536
+
+struct TRACE_EVENT {
+	const char * name;
+	char detail[48];
+	double begin, end;
+};
+
+struct TRACE_BUFFER {
+	string thread;
+	vector<TRACE_EVENT> events;
+	size_t next;                            // events[next] is overwritten next
+	bool wrapped;                           // events[next..] are older than events[..next]
+};
+
+bool tracing = false;
+int traceSample = 1;
+double traceStart, traceFrom, traceTo;
+vector<TRACE_BUFFER *> traceBuffers;        // in order of registration (the trace's thread ids)
+pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread TRACE_BUFFER * traceBuffer = NULL; // the buffer of the calling thread
+
+void initTrace(const SETTINGS_FILTERS &settings){
+	tracing = (settings.traceFile != "");
+	traceSample = max(settings.traceSample, 1);
+	traceStart = wallTime();
+	traceFrom = traceStart + settings.traceFrom;
+	traceTo = settings.traceTo > settings.traceFrom ? traceStart + settings.traceTo : 0;
+}
+
+//record the events of the calling thread under the given name (threads of the same name share a
+//buffer, so they must not run at the same time)
+void traceThread(const string &name){
+	if (!tracing) return;
+	pthread_mutex_lock(&traceMutex);
+	traceBuffer = NULL;
+	for (vector<TRACE_BUFFER *>::iterator it = traceBuffers.begin(); it < traceBuffers.end() && !traceBuffer; ++it)
+		if ((*it)->thread == name) traceBuffer = *it;
+	if (!traceBuffer) {
+		traceBuffer = new TRACE_BUFFER;
+		traceBuffer->thread = name;
+		traceBuffer->events.resize(TRACE_BUFFER_SIZE);
+		traceBuffer->next = 0;
+		traceBuffer->wrapped = false;
+		traceBuffers.push_back(traceBuffer);
+	}
+	pthread_mutex_unlock(&traceMutex);
+}
+
+//whether the locus on the given line of the region file is sampled
+bool traceLocus(size_t line){
+	return tracing && line % traceSample == 0;
+}
+
+//record a span of the calling thread, from begin to end (now if 0)
+void traceEvent(const char *name, double begin, const string &detail, double end){
+	if (!tracing || !traceBuffer) return;
+	if (!end) end = wallTime();
+	if (end < traceFrom || (traceTo && begin > traceTo)) return;
+
+	TRACE_EVENT &event = traceBuffer->events[traceBuffer->next];
+	event.name = name;
+	strncpy(event.detail, detail.c_str(), sizeof(event.detail) - 1);
+	event.detail[sizeof(event.detail) - 1] = '\0';
+	event.begin = begin;
+	event.end = end;
+	if (++traceBuffer->next == traceBuffer->events.size()) {
+		traceBuffer->next = 0;
+		traceBuffer->wrapped = true;
+	}
+}
+
+//escape a JSON string
+string jsonString(const string &value){
+	string escaped = "\"";
+	for (string::const_iterator c = value.begin(); c < value.end(); ++c) {
+		if (*c == '"' || *c == '\\') escaped += '\\';
+		if (*c < ' ') escaped += ' ';
+		else escaped += *c;
+	}
+	return escaped + '"';
+}
+
+//write the events of all threads (which must have finished recording)
+void writeTrace(string filename){
+	if (!tracing) return;
+	ofstream out(filename.c_str());
+	out << setiosflags(ios::fixed) << setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	for (size_t tid = 0; tid < traceBuffers.size(); ++tid) {
+		const TRACE_BUFFER &buffer = *traceBuffers[tid];
+		out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"name\":\"thread_name\",\"args\":{\"name\":" << jsonString(buffer.thread) << "}}";
+		first = false;
+
+		size_t count = buffer.wrapped ? buffer.events.size() : buffer.next;
+		for (size_t i = 0; i < count; ++i) {
+			const TRACE_EVENT &event = buffer.events[(buffer.wrapped ? buffer.next + i : i) % buffer.events.size()];
+			out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"name\":" << jsonString(event.name);
+			out << ",\"ts\":" << (event.begin - traceStart) * 1e6 << ",\"dur\":" << (event.end - event.begin) * 1e6;
+			if (event.detail[0]) out << ",\"args\":{\"detail\":" << jsonString(event.detail) << "}";
+			out << "}";
+		}
+	}
+	out << "\n]}\n";
+	if (out.fail()) perror("Error writing trace file");
+}